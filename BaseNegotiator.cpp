@@ -25,6 +25,7 @@
 #include "BaseNegotiator.h"
 #include "Option.h"
 #include <errno.h>
+#include <poll.h>
 
 /*************************************************************************
 *  Function name:BaseNegotiator::BaseNegotiator
@@ -38,6 +39,7 @@
 BaseNegotiator::BaseNegotiator(){
 	udp_sock = -1;
 	tcp_sock = -1;
+	pdu_reader_init(&tcp_reader);
 	// Construct server side address structure
 	//	memset(&serverAddr,0,sizeof(serverAddr));
 	//	serverAddr.sin6_family = AF_INET6;
@@ -104,13 +106,14 @@ ERRNO BaseNegotiator::client_udp_init(const int udp_sock,const char serverIP[],
 /*************************************************************************
 *  Function name:BaseNegotiator::server_tcp_init
 *  Description:server tcp socket init
-*  Parameter:	none
+*  Parameter:	const int listen_sock
+				int backlog		//length of the queue of connections not accepted yet
 *  Return:ERRNO
 *  Remark:
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-05-20
 *************************************************************************/
-ERRNO BaseNegotiator::server_tcp_init(const int listen_sock)
+ERRNO BaseNegotiator::server_tcp_init(const int listen_sock, int backlog)
 {
 
 	struct sockaddr_in6 inet_addr;
@@ -119,13 +122,17 @@ ERRNO BaseNegotiator::server_tcp_init(const int listen_sock)
 	inet_addr.sin6_port = htons(port);
 	inet_addr.sin6_addr = in6addr_any;
 
+	// a restarted server can bind while old connections are in TIME_WAIT
+	int on = 1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
 	// bind
 	if(0 != (bind(listen_sock,(struct sockaddr*)&inet_addr,sizeof(inet_addr))))
 	{
 	   return BIND_ERR;
 	}
 
-	if( -1 == listen(listen_sock, 10))
+	if( -1 == listen(listen_sock, backlog))
 	{
 	    //listen
 		dieWithUserMessager("listen socket error: %s(errno: %d)\n");
@@ -149,6 +156,7 @@ ERRNO BaseNegotiator::server_tcp_init(const int listen_sock)
 ERRNO BaseNegotiator::client_tcp_init(const int tcp_sock, const char serverIP[])
 {
 	this->tcp_sock = tcp_sock;
+	pdu_reader_init(&tcp_reader);
 
 	struct sockaddr_in6 server_addr;
 	memset(&server_addr,0,sizeof(server_addr));
@@ -194,22 +202,36 @@ ERRNO BaseNegotiator::send_pdu(const void* data,size_t buffer_size,enum MSG_TYPE
 		return SOCK_NOT_INIT;
 	}
     // encapsulate PDU
-    msg pdu;
-    int rtnval = encode(&pdu, type, session_id, data,buffer_size);
+    msg_header hdr;
+    int rtnval = encode_header(&hdr, type, session_id, buffer_size);
 //    std::cout << "send type"<< type << std::endl;
     if(rtnval != SUCCESS){
         return ENCODE_ERR;
     }
 
-    // send PDU
-    ssize_t numBytes = sendto(udp_sock,&pdu, sizeof(pdu), 0, (struct sockaddr*)&targetAddr,sizeof(targetAddr));
+    // send PDU, the header and the data go out as separate iovecs
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = MSG_HEADER_LEN;
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = buffer_size;
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &targetAddr;
+    mh.msg_namelen = sizeof(targetAddr);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+
+    size_t pdu_size = MSG_HEADER_LEN + buffer_size;
+    ssize_t numBytes = sendmsg(udp_sock, &mh, 0);
     if(numBytes < 0){
         if(errno == EADDRNOTAVAIL){
             return ADDR_ERR;
         }
         return SEND_ERR;
     }
-    else if((size_t)numBytes < sizeof(pdu)){
+    else if((size_t)numBytes < pdu_size){
         return SEND_UNEXPECTED_BYTES_ERR;
     }
 
@@ -244,14 +266,157 @@ ERRNO BaseNegotiator::recv_pdu(char data[],size_t &buffer_size,enum MSG_TYPE &ty
         return RECV_ERR;
     }
 
-    memset(data, 0, MAXSTRINGLENGTH);
-    ERRNO rtnval = decode(&pdu_buf,type, session_id, data,buffer_size);
+    ERRNO rtnval = decode(&pdu_buf,numBytes,type, session_id, data,buffer_size);
 
 //    std::cout << "recv type"<<  type << std::endl;
 
     return rtnval;
 }
 
+/*************************************************************************
+*  Function name:BaseNegotiator::recv_pdus
+*  Description:receive the pdus waiting on a udp socket, several per system call
+*  Parameter:	int udp_sock
+				msg pdus[]						//filled with the received pdus, still encoded
+				size_t pdu_sizes[]				//size of each received pdu
+				struct sockaddr_in6 fromAddrs[]	//sender of each received pdu
+				struct in6_pktinfo toInfos[]	//destination address and interface of each received pdu, may be NULL;
+												//needs IPV6_RECVPKTINFO on udp_sock, in6addr_any and 0 otherwise
+				int max_count					//size of the arrays
+				int &count						//number of pdus received
+*  Return:ERRNO
+*  Remark:does not block, count is 0 when nothing is waiting. Use decode() on each pdu.
+*  Modification record:
+*************************************************************************/
+ERRNO BaseNegotiator::recv_pdus(int udp_sock,msg pdus[],size_t pdu_sizes[],struct sockaddr_in6 fromAddrs[],struct in6_pktinfo toInfos[],int max_count,int &count)
+{
+	count = 0;
+	if(udp_sock < 0)
+	{
+		dieWithUserMessager("udp_sock not init");
+		return SOCK_NOT_INIT;
+	}
+	if(max_count > PDU_BATCH_SIZE)
+	{
+		max_count = PDU_BATCH_SIZE;
+	}
+
+	struct mmsghdr mmh[PDU_BATCH_SIZE];
+	struct iovec iov[PDU_BATCH_SIZE];
+	char control[PDU_BATCH_SIZE][CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	memset(mmh, 0, sizeof(struct mmsghdr) * max_count);
+	for(int i = 0; i < max_count; i++)
+	{
+		iov[i].iov_base = &pdus[i];
+		iov[i].iov_len = sizeof(msg);
+		mmh[i].msg_hdr.msg_name = &fromAddrs[i];
+		mmh[i].msg_hdr.msg_namelen = sizeof(fromAddrs[i]);
+		mmh[i].msg_hdr.msg_iov = &iov[i];
+		mmh[i].msg_hdr.msg_iovlen = 1;
+		if(toInfos != NULL)
+		{
+			mmh[i].msg_hdr.msg_control = control[i];
+			mmh[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+	}
+
+	int n;
+	do{
+		n = recvmmsg(udp_sock, mmh, max_count, MSG_DONTWAIT, NULL);
+	}while(n < 0 && errno == EINTR);
+	if(n < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return SUCCESS;
+		}
+		return RECV_ERR;
+	}
+
+	for(int i = 0; i < n; i++)
+	{
+		pdu_sizes[i] = mmh[i].msg_len;
+		if(toInfos == NULL)
+		{
+			continue;
+		}
+		toInfos[i].ipi6_addr = in6addr_any;
+		toInfos[i].ipi6_ifindex = 0;
+		for(struct cmsghdr *cm = CMSG_FIRSTHDR(&mmh[i].msg_hdr); cm != NULL; cm = CMSG_NXTHDR(&mmh[i].msg_hdr, cm))
+		{
+			if(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_PKTINFO)
+			{
+				memcpy(&toInfos[i], CMSG_DATA(cm), sizeof(toInfos[i]));
+			}
+		}
+	}
+	count = n;
+	return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name:BaseNegotiator::send_pdus
+*  Description:send several pdus by udp, as few system calls as possible
+*  Parameter:	int udp_sock
+				msg_header hdrs[]					//headers, filled in with encode_header()
+				const void* const data[]			//data of each pdu
+				const size_t buffer_sizes[]			//size of each data
+				struct sockaddr_in6 targetAddrs[]	//receiver of each pdu
+				int count							//number of pdus, at most PDU_BATCH_SIZE
+*  Return:ERRNO
+*  Remark:a pdu that cannot be sent is skipped, the others are still sent and the error is returned
+*  Modification record:
+*************************************************************************/
+ERRNO BaseNegotiator::send_pdus(int udp_sock,msg_header hdrs[],const void* const data[],const size_t buffer_sizes[],struct sockaddr_in6 targetAddrs[],int count)
+{
+	if(udp_sock < 0)
+	{
+		dieWithUserMessager("udp_sock not init");
+		return SOCK_NOT_INIT;
+	}
+	if(count > PDU_BATCH_SIZE)
+	{
+		return SEND_ERR;
+	}
+
+	struct mmsghdr mmh[PDU_BATCH_SIZE];
+	struct iovec iov[PDU_BATCH_SIZE][2];
+	memset(mmh, 0, sizeof(struct mmsghdr) * count);
+	for(int i = 0; i < count; i++)
+	{
+		iov[i][0].iov_base = &hdrs[i];
+		iov[i][0].iov_len = MSG_HEADER_LEN;
+		iov[i][1].iov_base = (void*)data[i];
+		iov[i][1].iov_len = buffer_sizes[i];
+		mmh[i].msg_hdr.msg_name = &targetAddrs[i];
+		mmh[i].msg_hdr.msg_namelen = sizeof(targetAddrs[i]);
+		mmh[i].msg_hdr.msg_iov = iov[i];
+		mmh[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	ERRNO rtnval = SUCCESS;
+	int sent = 0;
+	while(sent < count)
+	{
+		int n = sendmmsg(udp_sock, mmh + sent, count - sent, 0);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			// the first unsent pdu failed, skip it
+			rtnval = (errno == EADDRNOTAVAIL) ? ADDR_ERR : SEND_ERR;
+			sent++;
+			continue;
+		}
+		for(int i = sent; i < sent + n; i++)
+		{
+			if(mmh[i].msg_len < MSG_HEADER_LEN + buffer_sizes[i]){
+				rtnval = SEND_UNEXPECTED_BYTES_ERR;
+			}
+		}
+		sent += n;
+	}
+	return rtnval;
+}
+
 /*************************************************************************
 *  Function name:BaseNegotiator::write_pdu
 *  Description:To send a pdu(Protocol Data Unit) by tcp
@@ -272,8 +437,8 @@ ERRNO BaseNegotiator::write_pdu(const void* data,size_t buffer_size,enum MSG_TYP
 		return SOCK_NOT_INIT;
 	}
 	// encapsulate PDU
-	msg pdu;
-	int rtnval = encode(&pdu, type, session_id, data,buffer_size);
+	msg_header hdr;
+	int rtnval = encode_header(&hdr, type, session_id, buffer_size);
 	if(rtnval != SUCCESS){
 		return ENCODE_ERR;
 	}
@@ -282,19 +447,14 @@ ERRNO BaseNegotiator::write_pdu(const void* data,size_t buffer_size,enum MSG_TYP
 //			std::cout <<"before write   type  "<< recved_opt.get_type() <<std::endl
 //						 <<"len  "<< recved_opt.get_len() << std::endl
 //						 <<"value  "<< (char*)recved_opt.get_value() << std::endl <<buffer_size<< std::endl;
-	// send PDU
-	ssize_t numBytes = write(tcp_sock,&pdu, sizeof(pdu));
-	if(numBytes < 0){
-		if(errno == EADDRNOTAVAIL){
-			return ADDR_ERR;
-		}
-		return SEND_ERR;
-	}
-	else if((size_t)numBytes < sizeof(pdu)){
-		return SEND_UNEXPECTED_BYTES_ERR;
-	}
-
-	return SUCCESS;
+	// send PDU, the header and the data go out as separate iovecs
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = MSG_HEADER_LEN;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = buffer_size;
+
+	return writev_full(tcp_sock, iov, 2);
 }
 
 /*************************************************************************
@@ -317,22 +477,72 @@ ERRNO BaseNegotiator::read_pdu(char data[],size_t &buffer_size,enum MSG_TYPE &ty
 		return SOCK_NOT_INIT;
 	}
 
-	msg pdu_buf;
-	ssize_t numBytes = read(tcp_sock, &pdu_buf, sizeof(pdu_buf));
-	if(numBytes < 0){
-		return RECV_ERR;
+	// the stream carries no boundaries, PDUs already buffered by an earlier read are taken first
+	ERRNO rtnval;
+	while((rtnval = pdu_reader_next(&tcp_reader, type, session_id, data, buffer_size)) == MSG_INCOMPLETE)
+	{
+		if(pdu_reader_fill(&tcp_reader, tcp_sock) != SUCCESS){
+			// closed, failed or timed out
+			return RECV_ERR;
+		}
 	}
-
-	memset(data, 0, MAXSTRINGLENGTH);
-	ERRNO rtnval = decode(&pdu_buf,type, session_id, data,buffer_size);
-//	Objective_Option recved_opt = Objective_Option::parse_bits((uint16_t *)data);
-//		std::cout <<"after read    type  "<< recved_opt.get_type() <<std::endl
-//					 <<"len  "<< recved_opt.get_len() << std::endl
-//					 <<"value  "<< (char*)recved_opt.get_value() << std::endl <<buffer_size<< std::endl;
-
 	return rtnval;
 }
 
+/*************************************************************************
+*  Function name:BaseNegotiator::writev_full
+*  Description:write all bytes described by iov to a stream socket
+*  Parameter:	int fd
+						struct iovec* iov		//advanced in place on short writes
+						int iovcnt
+*  Return:ERRNO
+*  Remark:a non-blocking fd is waited on while its send buffer is full, for RESPONSE_TIMEOUT_MS at most
+*  Modification record:
+*************************************************************************/
+ERRNO BaseNegotiator::writev_full(int fd, struct iovec* iov, int iovcnt)
+{
+	while(iovcnt > 0)
+	{
+		ssize_t numBytes = writev(fd, iov, iovcnt);
+		if(numBytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				struct pollfd pfd;
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				int ready = poll(&pfd, 1, RESPONSE_TIMEOUT_MS);
+				if(ready > 0 || (ready < 0 && errno == EINTR)){
+					continue;
+				}
+				return SEND_ERR;
+			}
+			if(errno == EADDRNOTAVAIL){
+				return ADDR_ERR;
+			}
+			return SEND_ERR;
+		}
+		else if(numBytes == 0){
+			return SEND_UNEXPECTED_BYTES_ERR;
+		}
+		// skip what has been written
+		while(iovcnt > 0 && (size_t)numBytes >= iov->iov_len)
+		{
+			numBytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + numBytes;
+			iov->iov_len -= numBytes;
+		}
+	}
+	return SUCCESS;
+}
+
 /*************************************************************************
 *  Function name:BaseNegotiator::sockAddrEqual
 *  Description:to judge whether the actual address equals the expected address.
@@ -27,6 +27,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -34,7 +35,10 @@
 #include "msg.h"
 #include "Errno.h"
 
-
+enum{
+    // most PDUs moved by one recv_pdus/send_pdus call
+    PDU_BATCH_SIZE = 32
+};
 
 class BaseNegotiator{
 
@@ -62,19 +66,26 @@ protected:
 	const static int port = 4444;
 	int udp_sock;
 	int tcp_sock;
+	// framing buffer of tcp_sock, used by read_pdu
+	pdu_reader tcp_reader;
 
 	void set_udp_sock(int udp_sock){this->udp_sock = udp_sock;}
-	void set_tcp_sock(int tcp_sock){this->tcp_sock = tcp_sock;}
+	void set_tcp_sock(int tcp_sock){this->tcp_sock = tcp_sock; pdu_reader_init(&tcp_reader);}
 
     ERRNO write_pdu(const void* data,size_t buffer_size,enum MSG_TYPE type,uint32_t session_id);
     ERRNO read_pdu(char data[],size_t &buffer_size,enum MSG_TYPE &type,uint32_t &session_id);
     ERRNO send_pdu(const void* data,size_t buffer_size,enum MSG_TYPE type,uint32_t session_id,struct sockaddr_in6 targetAddr);
     ERRNO recv_pdu(char data[],size_t &buffer_size,enum MSG_TYPE &type,struct sockaddr_in6 &fromAddr,uint32_t &session_id);
+    // batched udp i/o, up to PDU_BATCH_SIZE datagrams per system call
+    static ERRNO recv_pdus(int udp_sock,msg pdus[],size_t pdu_sizes[],struct sockaddr_in6 fromAddrs[],struct in6_pktinfo toInfos[],int max_count,int &count);
+    static ERRNO send_pdus(int udp_sock,msg_header hdrs[],const void* const data[],const size_t buffer_sizes[],struct sockaddr_in6 targetAddrs[],int count);
+    // write all bytes described by iov to a stream socket
+    static ERRNO writev_full(int fd, struct iovec* iov, int iovcnt);
     //determine whether two socket addresses are equal
     bool sockAddrEqual(struct sockaddr_in6 actual ,struct sockaddr_in6 expected);
 
     ERRNO server_udp_init(const int udp_sockfd);
-    ERRNO server_tcp_init(const int tcp_sockfd);
+    ERRNO server_tcp_init(const int tcp_sockfd, int backlog);
     ERRNO client_udp_init(const int udp_sock,const char serverIP[], struct sockaddr_in6 &server_addr);
 	ERRNO client_tcp_init(const int tcp_sockfd,const char serverIP[]);
 
@@ -23,6 +23,7 @@
 */
 
 #include "Client.h"
+#include "UniqueSessionId.h"
 #include <stdio.h>
 
 // initialize try times
@@ -70,6 +71,7 @@ void Client::store_last_options(const void* buffer,size_t buffer_size)
 {
     memset(lastTopOptions, 0, MAXSTRINGLENGTH);
     memcpy(lastTopOptions, buffer, buffer_size);
+    lastTopOptions_len = buffer_size;
     //std::cout<<"lastTopOptions = "<<lastTopOptions<<std::endl;
 }
 
@@ -95,15 +97,16 @@ Client::Client():cur_states(OFF)
 
     cur_states = OFF;
     memset(buffer_nego_obj, 0, MAXSTRINGLENGTH);
+    buffer_nego_len = 0;
+    recv_size = 0;
+    lastTopOptions_len = 0;
     session_id = 0;
     loop_count = 5;
     flag = 0;
-    // initialize response timer
-    response_timer.tv_sec = RESONSE_TIMEOUT_SECOND;
-    response_timer.tv_usec = 0;
-
-    wait_timer.tv_sec = WAIT_TIMEOUT_SECOND;
-    wait_timer.tv_usec = 0;
+    objective_code = 0;
+    // initialize time-outs
+    response_timeout_ms = RESPONSE_TIMEOUT_MS;
+    wait_timeout_ms = WAIT_TIMEOUT_MS;
 
     // initialize try times
     try_times = 0;
@@ -202,7 +205,7 @@ ERRNO Client::recv(const void* buffer,enum MSG_TYPE &type)
             while(cur_states == WAIT_RESPONSE){
                 if((rtnval = recv_in_WAIT_RESPONSE(buffer, type)) == TIMEOUT && cur_states == WAIT_RESPONSE ){
                     // resend request message
-                    rtnval = send(lastTopOptions,strlen(lastTopOptions), DISCOVERY_MSG);
+                    rtnval = send(lastTopOptions,lastTopOptions_len, DISCOVERY_MSG);
                 }
             }
 
@@ -252,7 +255,13 @@ ERRNO Client::discover()
     {
         dieWithUserMessager("set sockopt failed");
     }
-    session_id= generate_random()%(MAX_SESSION_ID+1);
+    rtnval = UniqueSessionId::allocate(session_id);
+    if(rtnval != SUCCESS)
+    {
+        dieWithUserMessager("no free session id");
+        close(sock);
+        return rtnval;
+    }
 
 
     // send a discover request
@@ -260,18 +269,18 @@ ERRNO Client::discover()
     char buffer[MAXSTRINGLENGTH];
 
     Objective_Option obj_opt(Discovery, 0, (uint8_t*)"",0,0);
-    uint16_t * bits = obj_opt.to_bits();
-    memcpy(buffer, bits, Objective_Option::len_except_value);
+    uint16_t bits_size = obj_opt.to_bits(buffer, sizeof(buffer));
 
     client_udp_init(sock, "ff02::1", serverAddr);
 
     //std::cout<<"ready to send:"<<std::endl;
-    rtnval = send(buffer, strlen(buffer), DISCOVERY_MSG);
+    rtnval = send(buffer, bits_size, DISCOVERY_MSG);
 
     if(rtnval != SUCCESS)
     {
     	dieWithUserMessager("sendto failed");
 		//std::cout<<rtnval<<std::endl;
+      UniqueSessionId::release(session_id);
       return rtnval;
     }
 
@@ -279,6 +288,8 @@ ERRNO Client::discover()
     //rtnval = m.nrecvfrom(nsock,session_id,buffer,type);
 
     rtnval = recv(buffer,type);
+    // the discovery session ends here either way
+    UniqueSessionId::release(session_id);
     if(rtnval == SUCCESS)
     {
     	cur_states = OFF;
@@ -294,7 +305,9 @@ ERRNO Client::discover()
     {
     	if(type == RESPONSE_MSG)
 		{
-			Option recved_opt = Option::parse_bits((uint16_t *)buffer);
+			OptionView recved_opt;
+			if(recved_opt.parse(buffer, recv_size) != SUCCESS)
+				return ERROR;
 			option_type type = recved_opt.get_type();
 			char * recved_addr;
 
@@ -321,3 +334,64 @@ ERRNO Client::discover()
    //m.nclose("",0);
     return SUCCESS;
 }
+
+/*************************************************************************
+*  Function name: Client::asa_negotiate_encoded
+*  Description: pass a proposed value to the ASA and get the value it wants
+*  Parameter: 	const uint8_t * value	//proposed value, as received
+*  				uint16_t len			//length of value
+*  				uint8_t * answer		//buffer for the wanted value
+*  				uint16_t &answer_len	//size of answer on input, length of the wanted value on output
+*  Return: 		ERRNO
+*  Remark: default for ASAs overriding asa_negotiate_result, whose values are C strings
+*  Modification record:
+*************************************************************************/
+ERRNO Client::asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len)
+{
+    c_string_value proposed(value, len);
+    const char * asa_answer = (const char *)asa_negotiate_result(proposed.str);
+    if(asa_answer == NULL)
+    {
+        return NULL_POINT_ERR;
+    }
+    size_t asa_answer_len = strlen(asa_answer);
+    if(asa_answer_len > answer_len)
+    {
+        return OPTIONS_TOO_LONG_ERR;
+    }
+    memmove(answer, asa_answer, asa_answer_len);
+    answer_len = asa_answer_len;
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: Client::asa_geq_encoded
+*  Description: ask the ASA whether two values are equal
+*  Parameter: 	const uint8_t * value_a, uint16_t len_a
+*  				const uint8_t * value_b, uint16_t len_b
+*  Return: 		bool
+*  Remark: default for ASAs overriding asa_geq_fn, whose values are C strings; the values are
+*          copied and terminated, an answer written to a buffer is not
+*  Modification record:
+*************************************************************************/
+bool Client::asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b)
+{
+    c_string_value a(value_a, len_a);
+    c_string_value b(value_b, len_b);
+    return asa_geq_fn(a.str, b.str);
+}
+
+/*************************************************************************
+*  Function name: Client::do_configuration_encoded
+*  Description: pass the negotiation result to the ASA
+*  Parameter: 	const uint8_t * nego_result
+*  				uint16_t len			//length of nego_result
+*  Return: 		void
+*  Remark: default for ASAs overriding do_configuration, whose values are C strings
+*  Modification record:
+*************************************************************************/
+void Client::do_configuration_encoded(const uint8_t * nego_result, uint16_t len)
+{
+    c_string_value result(nego_result, len);
+    do_configuration(result.str);
+}
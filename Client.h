@@ -26,7 +26,9 @@
 #define __demo__Client__
 
 #include "BaseNegotiator.h"
+#include "NegotiationTask.h"
 #include "Option.h"
+#include "ObjectiveCodec.h"
 #include <unistd.h>
 #include <string.h>
 
@@ -49,18 +51,25 @@ private:
     int try_times;
     // upper data send last time
     char lastTopOptions[MAXSTRINGLENGTH];
-    // timers
-    struct timeval response_timer;
-    struct timeval wait_timer;
+    size_t lastTopOptions_len;
+    // time-outs in milliseconds
+    int response_timeout_ms;
+    int wait_timeout_ms;
 
     uint32_t session_id;
     client_states cur_states;
     struct sockaddr_in6 serverAddr;
     struct sockaddr_in6 negoAddr;
 
+    // size of the data received last by recv_in_time
+    size_t recv_size;
+
     char buffer_nego_obj[MAXSTRINGLENGTH];
+    size_t buffer_nego_len;
     int loop_count;
     int flag;
+    // code of the objective negotiated and synchronized
+    uint8_t objective_code;
 
     // increase try times
     void increase_try_times();
@@ -72,7 +81,7 @@ private:
     //State functions
     ERRNO send_discover(const void* buffer,size_t buffer_size,enum MSG_TYPE type);
     ERRNO send_in_INFORMED(const void* buffer,size_t buffer_size, enum MSG_TYPE type);
-    ERRNO recv_in_time(const void* buffer,enum MSG_TYPE &type,struct timeval tv);
+    ERRNO recv_in_time(const void* buffer,enum MSG_TYPE &type,int timeout_ms);
     ERRNO recv_in_WAIT_RESPONSE(const void* buffer,enum MSG_TYPE &type);
     ERRNO recv_in_WAIT(const void* buffer,enum MSG_TYPE &type);
 
@@ -84,8 +93,10 @@ private:
 
 
     ERRNO send_negotiate(const void* buffer,size_t buffer_size,enum MSG_TYPE type);
-    ERRNO do_negotiate(const void* buffer,size_t buffer_size,enum MSG_TYPE type);
-    uint16_t * nego_obj_opt2bits(const void* opt_data, uint16_t data_size);
+    // the negotiation after the REQUEST_MSG, a coroutine send_negotiate resumes with each PDU
+    NegotiationTask negotiation();
+    // next PDU of this session, CLIENT_RECV_NOTHING_ERR when none came in timeout_ms
+    ERRNO read_session_pdu(content &pdu, unsigned int timeout_ms);
 
 	 // clear up after discovery
     void clearup();
@@ -114,8 +125,14 @@ public:
     ERRNO discover();
 
     ERRNO negotiate(const void* buffer_obj);
+    ERRNO negotiate(const void* buffer_obj, uint16_t value_len);
 
     ERRNO synchronize(const void* buffer_obj);
+    ERRNO synchronize(const void* buffer_obj, uint16_t value_len);
+
+    // the objective negotiate() and synchronize() are for, 0 (the default) for the one the
+    // server serves with the hooks of ServerMaster, see ServerMaster::register_objective
+    void set_objective_code(uint8_t code){objective_code = code;}
 
 /*************************************************************************
 *  Function name : Client::asa_geq_fn
@@ -160,7 +177,85 @@ public:
 		std::cout << "do configuration...." << std::endl;
 	}
 
+    // the hooks the negotiation calls, working on encoded values and their lengths;
+    // by default they pass the values to the three hooks above as C strings
+    virtual ERRNO asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len);
+    virtual bool asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b);
+    virtual void do_configuration_encoded(const uint8_t * nego_result, uint16_t len);
+
+};
+
+// Client for an objective whose values are of type T, see objective_codec
+template<typename T>
+class Typed_Client:public Client{
+public:
+    using Client::negotiate;
+    using Client::synchronize;
+
+/*************************************************************************
+*  Function name : Typed_Client::negotiate
+*  Description:start to negotiate a typed objective
+*  Parameter:	const T & value
+*  Return:ERRNO
+*  Remark:
+*  Modification record:
+*************************************************************************/
+    ERRNO negotiate(const T & value)
+    {
+        uint8_t bits[MAXSTRINGLENGTH - Objective_Option::len_except_value];
+        uint16_t len;
+        if(!objective_codec<T>::encode(value, bits, sizeof(bits), len))
+            return OPTIONS_TOO_LONG_ERR;
+        return Client::negotiate(bits, len);
+    }
+
+/*************************************************************************
+*  Function name : Typed_Client::synchronize
+*  Description:start to synchronize a typed objective
+*  Parameter:	const T & value
+*  Return:ERRNO
+*  Remark:
+*  Modification record:
+*************************************************************************/
+    ERRNO synchronize(const T & value)
+    {
+        uint8_t bits[MAXSTRINGLENGTH - Objective_Option::len_except_value];
+        uint16_t len;
+        if(!objective_codec<T>::encode(value, bits, sizeof(bits), len))
+            return OPTIONS_TOO_LONG_ERR;
+        return Client::synchronize(bits, len);
+    }
+
+    // provided by the ASA, see the untyped hooks of Client
+    virtual bool asa_geq(const T & value_a, const T & value_b) = 0;
+    virtual T asa_negotiate(const T & value) = 0;
+    virtual void do_configuration(const T & nego_result) = 0;
+
+    virtual ERRNO asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len)
+    {
+        T proposed;
+        if(!objective_codec<T>::decode(value, len, proposed))
+            return OPTION_LEN_ERR;
+        T wanted = asa_negotiate(proposed);
+        if(!objective_codec<T>::encode(wanted, answer, answer_len, answer_len))
+            return OPTIONS_TOO_LONG_ERR;
+        return SUCCESS;
+    }
+
+    virtual bool asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b)
+    {
+        T a, b;
+        if(!objective_codec<T>::decode(value_a, len_a, a) || !objective_codec<T>::decode(value_b, len_b, b))
+            return false;
+        return asa_geq(a, b);
+    }
 
+    virtual void do_configuration_encoded(const uint8_t * nego_result, uint16_t len)
+    {
+        T result;
+        if(objective_codec<T>::decode(nego_result, len, result))
+            do_configuration(result);
+    }
 };
 
 #endif /* defined(__demo__Client__) */
@@ -21,6 +21,7 @@
 ************************************************************************
 */
 #include "Client.h"
+#include "UniqueSessionId.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -28,16 +29,49 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <string.h>
+#include <errno.h>
+
+/*************************************************************************
+*  Function name: set_sock_timeout
+*  Description: set the send or receive time-out of a socket
+*  Parameter: 	int sock
+*  				int optname		//SO_SNDTIMEO or SO_RCVTIMEO
+*  				uint32_t ms		//time-out in milliseconds
+*  Return: 		void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+static void set_sock_timeout(int sock, int optname, uint32_t ms)
+{
+	struct timeval Timeout;
+	Timeout.tv_sec = ms / 1000;
+	Timeout.tv_usec = (ms % 1000) * 1000;
+	setsockopt(sock,SOL_SOCKET,optname,(const void *)&Timeout,(socklen_t)sizeof(struct timeval));
+}
 
 /*************************************************************************
 *  Function name: Client::negotiate
 *  Description: Function for negotiation in class Client using TCP
-*  Parameter: 	const void * buffer_obj	//pointer to negotiation objective
+*  Parameter: 	const void * buffer_obj	//pointer to negotiation objective, a C string
 *  Return: 		ERRNO
 *  Remark:
 *  Lastly modified by Kangning Xu on 15-5-25
 *************************************************************************/
 ERRNO Client::negotiate(const void * buffer_obj)
+{
+	return negotiate(buffer_obj, strlen((char*)buffer_obj));
+}
+
+/*************************************************************************
+*  Function name: Client::negotiate
+*  Description: Function for negotiation in class Client using TCP
+*  Parameter: 	const void * buffer_obj	//pointer to negotiation objective
+*  				uint16_t value_len		//length of the objective in octets
+*  Return: 		ERRNO
+*  Remark:for objective values that are not C strings
+*  Modification record:
+*************************************************************************/
+ERRNO Client::negotiate(const void * buffer_obj, uint16_t value_len)
 {
 	std::cout << "Negotiation start!!!" << std::endl;
 	 struct sockaddr_in6 BroadcastAddr;
@@ -55,15 +89,22 @@ ERRNO Client::negotiate(const void * buffer_obj)
 	 }
 
 
-	 session_id= generate_random()%(MAX_SESSION_ID+1);
+	 if(UniqueSessionId::allocate(session_id) != SUCCESS)
+	 {
+		 dieWithUserMessager("no free session id");
+		 return ERROR;
+	 }
 
 	 loop_count = 5;
 	 flag = 0;
 
-	 uint16_t value_len = strlen((char*)buffer_obj) ;
-	 Objective_Option obj_opt(Negotiation, value_len, (uint8_t*)buffer_obj,loop_count,flag);
-	 uint16_t * bits = obj_opt.to_bits();
-	 memcpy(buffer_nego_obj, bits, value_len + Objective_Option::len_except_value);
+	 Objective_Option obj_opt(Negotiation, value_len, (uint8_t*)buffer_obj,loop_count,flag,objective_code);
+	 buffer_nego_len = obj_opt.to_bits(buffer_nego_obj, sizeof(buffer_nego_obj));
+	 if(buffer_nego_len == 0)
+	 {
+		 UniqueSessionId::release(session_id);
+		 return OPTIONS_TOO_LONG_ERR;
+	 }
 
 	 //create asynchronous thread
 	 pthread_t id;
@@ -71,6 +112,7 @@ ERRNO Client::negotiate(const void * buffer_obj)
 //	 sleep(5);
 	 if(ret) {
 	    std::cout << "Create pthread error!" << std::endl;
+	    UniqueSessionId::release(session_id);
 	    return ERROR;
 	 }
 	 else
@@ -97,7 +139,8 @@ void *Client::nego_thread(void* _client)
 //								 <<"loop count" << (int)recved_opt.get_loop_count() << std::endl
 //		 						 <<"value  "<< (char*)recved_opt.get_value() << std::endl << std::endl;
 	 //nego, an iterative process
-	 c->send_tcp(c->buffer_nego_obj,MAXSTRINGLENGTH,REQUEST_MSG);
+	 c->send_tcp(c->buffer_nego_obj,c->buffer_nego_len,REQUEST_MSG);
+	 UniqueSessionId::release(c->session_id);
 
 
 	 //strcpy((char *)c->buffer_nego_obj,buffer);
@@ -183,11 +226,10 @@ ERRNO Client::send_negotiate(const void* buffer,size_t buffer_size,enum MSG_TYPE
 			}
 	}
 
-	struct timeval Timeout = {10, 0};
 	//send timeout
-	setsockopt(tcp_sock,SOL_SOCKET,SO_SNDTIMEO,(const void *)&Timeout,(socklen_t)sizeof(struct timeval));
+	set_sock_timeout(tcp_sock, SO_SNDTIMEO, RESPONSE_TIMEOUT_MS);
 	//recv timeout
-	setsockopt(tcp_sock,SOL_SOCKET,SO_RCVTIMEO,(const void *)&Timeout,(socklen_t)sizeof(struct timeval));
+	set_sock_timeout(tcp_sock, SO_RCVTIMEO, RESPONSE_TIMEOUT_MS);
 
 	if(loop_count == 0) return ERROR;
 	//send pdu
@@ -195,196 +237,211 @@ ERRNO Client::send_negotiate(const void* buffer,size_t buffer_size,enum MSG_TYPE
 	loop_count--;
 
 	if(rtnval != SUCCESS)
+	{
+		close(tcp_sock);
 		return rtnval;
+	}
 
-	//recv pdu
-	uint32_t actual_session_id;
-	rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
-	while(actual_session_id != session_id)
+	//the negotiation waits for the answers as a coroutine, resumed here with each PDU of the session
+	NegotiationTask nego = negotiation();
+	nego.start();
+	content pdu;
+	pdu.data_len = 0;
+	while(!nego.done())
 	{
-		//dieWithUserMessager("session_id not match");
-		//return CLIENT_RECV_NOMATCHED_SESSION_ID_ERR;
-		rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
+		rtnval = read_session_pdu(pdu, nego.wait_ms());
+		if(rtnval == SUCCESS)
+			nego.resume(pdu);
+		else if(rtnval == CLIENT_RECV_NOTHING_ERR)
+			nego.time_out();
+		else
+			break;
+	}
+	if(nego.done())
+	{
+		rtnval = nego.result();
+		//the last option received goes back to the caller, synchronize() reads it from there
+		memcpy((char*)buffer, pdu.data, pdu.data_len < MAXSTRINGLENGTH ? pdu.data_len + 1 : MAXSTRINGLENGTH);
 	}
-
-	//distribute
-	rtnval = do_negotiate(buffer,buffer_size,type);
 
 	close(tcp_sock);
 	return rtnval;
 }
 
 /*************************************************************************
-*  Function name: Client::do_negotiate
-*  Description: Processing received negotiation message: keep negotiating or wait or end
-*  Parameter: 	const void* buffer	//pointer to option
-*  				size_t buffer_size	//size of option
-*  				enum MSG_TYPE type	//type of message
-*  Return: 		ERRNO
-*  Remark:
-*  Lastly modified by Kangning Xu on 15-5-25
+*  Function name: Client::read_session_pdu
+*  Description: receive the next PDU of the current session
+*  Parameter: 	content &pdu				//the PDU received
+*  				unsigned int timeout_ms	//0 waits without time-out
+*  Return: 		ERRNO	//CLIENT_RECV_NOTHING_ERR when nothing came in time
+*  Remark:PDUs of other sessions are skipped
+*  Modification record:
 *************************************************************************/
-ERRNO Client::do_negotiate(const void* buffer,size_t buffer_size,enum MSG_TYPE type)
+ERRNO Client::read_session_pdu(content &pdu, unsigned int timeout_ms)
 {
-	void *asa_answer = NULL;
 	ERRNO rtnval;
-	struct timeval Timeout = {10, 0};
-
 	uint32_t actual_session_id;
 
-	//parse recived option as format Option
-	Option recved_opt = Option::parse_bits((uint16_t *)buffer);
-	option_type opt_type = recved_opt.get_type();
-//	uint16_t opt_len = recved_opt.get_len();
-	uint8_t * opt_vlaue = recved_opt.get_value();
-
-	//parse recived option as format Objective_Option
-	Objective_Option recved_obj_opt = Objective_Option::parse_bits((uint16_t *)buffer);
-//	option_type obj_opt_type = recved_obj_opt.get_type();
-//	uint16_t obj_opt_len = recved_obj_opt.get_len();
-	uint8_t * obj_opt_vlaue = recved_obj_opt.get_value();
-	loop_count = (int)recved_obj_opt.get_loop_count();
-	flag = (int)recved_obj_opt.get_flag();
-
-	loop_count--;
-
-	uint16_t value_len = 0;
-
-	Option accept_opt(Accept, 0, (uint8_t*)asa_answer);
-
-	Option decline_opt(Decline, 0, (uint8_t*)asa_answer);
+	set_sock_timeout(tcp_sock, SO_RCVTIMEO, timeout_ms);
+	do
+	{
+		errno = 0;
+		rtnval = read_pdu(pdu.data, pdu.data_len, pdu.type, actual_session_id);
+	}while(rtnval == SUCCESS && actual_session_id != session_id);
 
-	uint16_t * nego_bits;
-	char send_buffer[MAXSTRINGLENGTH];
+	//read_pdu gives RECV_ERR for a time-out too, the read left EAGAIN behind then
+	if(rtnval == RECV_ERR && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return CLIENT_RECV_NOTHING_ERR;
+	return rtnval;
+}
 
-	//distinguish received msg type
-	switch(type)
+/*************************************************************************
+*  Function name: Client::negotiation
+*  Description: Processing received negotiation messages: keep negotiating or wait or end
+*  Parameter: 	none
+*  Return: 		NegotiationTask	//suspended before its first wait
+*  Remark:a coroutine, waiting RESPONSE_TIMEOUT_MS for an answer or the time a WAIT_MSG asks for,
+*         at most WAIT_MSG_MAX_MS
+*  Modification record:
+*************************************************************************/
+NegotiationTask Client::negotiation()
+{
+	unsigned int wait_ms = RESPONSE_TIMEOUT_MS;
+	for(;;)
 	{
-		case NEGO_MSG:
-			cur_states = NEGOING;
-				//give msg to upper to gain an answer, judge the answer, take it(send NEGO_END_MSG) or more write and read and do_negotiate
+		const pdu_event &e = co_await NegotiationTask::next_pdu(wait_ms);
+		if(e.timed_out)
+			co_return CLIENT_RECV_NOTHING_ERR;
+
+		ERRNO rtnval;
+		//parse recived option once, its type tells whether it is an Objective_Option
+		OptionView recved_opt;
+		rtnval = recved_opt.parse(e.pdu->data, e.pdu->data_len);
+		if(rtnval != SUCCESS)
+			co_return rtnval;
+		option_type opt_type = recved_opt.get_type();
+		const uint8_t * opt_vlaue = recved_opt.get_value();
+		if(recved_opt.is_objective())
+		{
+			loop_count = (int)recved_opt.get_loop_count();
+			flag = (int)recved_opt.get_flag();
+
+			loop_count--;
+		}
 
-				asa_answer = asa_negotiate_result((void *)obj_opt_vlaue);
-				if(asa_geq_fn(asa_answer,(void *)obj_opt_vlaue))
+		//distinguish received msg type
+		switch(e.pdu->type)
+		{
+			case NEGO_MSG:
+			{
+				cur_states = NEGOING;
+				//give msg to upper to gain an answer, judge the answer, take it(send NEGO_END_MSG) or more write and read
+				uint8_t end_bits[Option::len_except_value];
+				uint16_t end_size;
+				char send_buffer[MAXSTRINGLENGTH];
+				// the ASA writes its answer right behind the option header in send_buffer
+				uint8_t * asa_answer = (uint8_t *)send_buffer + Objective_Option::len_except_value;
+				uint16_t answer_len = sizeof(send_buffer) - Objective_Option::len_except_value;
+
+				ERRNO asa_rtnval = asa_negotiate_encoded(opt_vlaue, recved_opt.get_len(), asa_answer, answer_len);
+				if(asa_rtnval == SUCCESS && asa_geq_encoded(asa_answer, answer_len, opt_vlaue, recved_opt.get_len()))
 				{
 					//upper take the answer, send NEGO_END_MSG with Accept
-					rtnval = write_pdu((const void *)accept_opt.to_bits(), accept_opt.get_len() + Option::len_except_value ,NEGO_END_MSG, session_id);
+					Option accept_opt(Accept, 0, NULL);
+					end_size = accept_opt.to_bits(end_bits, sizeof(end_bits));
+					rtnval = write_pdu((const void *)end_bits, end_size ,NEGO_END_MSG, session_id);
 					std::cout << "The negotiation is accepted" << std::endl;
-					do_configuration(obj_opt_vlaue);
-					return rtnval;
+					do_configuration_encoded(opt_vlaue, recved_opt.get_len());
+					co_return rtnval;
 				}
 				//need more negotiation
-				if(loop_count == 0)
+				if(loop_count == 0 || asa_rtnval != SUCCESS)
 				{
-					//send NEGO_END_MSG with Accept
-					rtnval = write_pdu((const void *)decline_opt.to_bits(), decline_opt.get_len()+ Option::len_except_value, NEGO_END_MSG, session_id);
+					//send NEGO_END_MSG with Decline
+					Option decline_opt(Decline, 0, NULL);
+					end_size = decline_opt.to_bits(end_bits, sizeof(end_bits));
+					rtnval = write_pdu((const void *)end_bits, end_size, NEGO_END_MSG, session_id);
 					std::cout << "The negotiation is over loop_count, so decline it" << std::endl;
-					return rtnval;
+					co_return rtnval;
 				}
 				//send new NEGO_MSG
-				value_len = strlen((char*)asa_answer);
+				Objective_Option::header_to_bits(send_buffer, Negotiation, answer_len, loop_count, flag, objective_code);
+				uint16_t nego_size = Objective_Option::len_except_value + answer_len;
 
-				nego_bits = nego_obj_opt2bits(asa_answer,value_len);
-				memcpy(send_buffer, nego_bits , value_len + Objective_Option::len_except_value);
+				rtnval = write_pdu((const void *)send_buffer,nego_size, NEGO_MSG, session_id);
+				store_last_options(send_buffer, nego_size);
 
-				rtnval = write_pdu((const void *)send_buffer,MAXSTRINGLENGTH, NEGO_MSG, session_id);
-				store_last_options(send_buffer, MAXSTRINGLENGTH);
-
-				if(rtnval != SUCCESS) return rtnval;
-				//recv pdu
-				rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
-				while(actual_session_id != session_id)
-				{
-					//dieWithUserMessager("session_id not match");
-					//return CLIENT_RECV_NOMATCHED_SESSION_ID_ERR;
-					rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
-				}
-				//distribute
-				rtnval = do_negotiate(buffer,buffer_size,type);
-
-			break;
-
-		case WAIT_MSG:
-			//if(loop_count == 0) return ERROR;
-			//sleep for a little while, then read and do_negotiate
-			cur_states = WAIT;
-
-			if(opt_type == Waiting_time)
-			{
-				Timeout.tv_sec = (int) * opt_vlaue;
-			}
-			else
-			{
-				rtnval = ERROR;
+				if(rtnval != SUCCESS)
+					co_return rtnval;
+				wait_ms = RESPONSE_TIMEOUT_MS;
 				break;
 			}
 
-			setsockopt(tcp_sock,SOL_SOCKET,SO_RCVTIMEO,(const void *)&Timeout,(socklen_t)sizeof(struct timeval));
+			case WAIT_MSG:
+				//if(loop_count == 0) return ERROR;
+				//wait a little longer for the answer
+				cur_states = WAIT;
 
-			rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
-
-			if(rtnval != SUCCESS) break;
-
-			while(actual_session_id != session_id)
-			{
-				//dieWithUserMessager("session_id not match");
-				//return CLIENT_RECV_NOMATCHED_SESSION_ID_ERR;
-				rtnval = read_pdu((char*)buffer,buffer_size,type,actual_session_id);
-			}
-
-			//reset Timeout and distribute new received msg
-			Timeout.tv_sec = 10;
-			setsockopt(tcp_sock,SOL_SOCKET,SO_RCVTIMEO,(const void *)&Timeout,(socklen_t)sizeof(struct timeval));
-
-			rtnval = do_negotiate(buffer,buffer_size,type);
-			break;
-
-		case NEGO_END_MSG:
-			//end_tcp
-			if(opt_type == Accept)
-			{
-				std::cout << "The negotiation is accepted" << std::endl;
-				Objective_Option obj_opt = Objective_Option::parse_bits((uint16_t *)lastTopOptions);
-				do_configuration(obj_opt.get_value());
-			}
-			else if (opt_type == Decline)
-				std::cout << "The negotiation is declined" << std::endl;
-			rtnval = SUCCESS;
-			break;
+				// the server tells how many milliseconds to wait; 0 would wait forever and is
+				// refused, and no peer keeps the client longer than WAIT_MSG_MAX_MS at a time
+				if(opt_type == Waiting_time && recved_opt.get_len() >= sizeof(uint32_t))
+				{
+					uint32_t ms;
+					memcpy(&ms, opt_vlaue, sizeof(ms));
+					if(ms == 0)
+						co_return ERROR;
+					wait_ms = ms < WAIT_MSG_MAX_MS ? ms : WAIT_MSG_MAX_MS;
+				}
+				else
+				{
+					co_return ERROR;
+				}
+				break;
 
-		default:
-			//wrong type, read and do_negotiate
-			//return CLIENT_RECV_UNEXCEPETD_MSG_TYPE_ERR;
-			rtnval = ERROR;
-			break;
+			case NEGO_END_MSG:
+				//end_tcp
+				if(opt_type == Accept)
+				{
+					std::cout << "The negotiation is accepted" << std::endl;
+					OptionView obj_opt;
+					if(obj_opt.parse(lastTopOptions, lastTopOptions_len) == SUCCESS)
+						do_configuration_encoded(obj_opt.get_value(), obj_opt.get_len());
+				}
+				else if (opt_type == Decline)
+					std::cout << "The negotiation is declined" << std::endl;
+				co_return SUCCESS;
+
+			default:
+				//wrong type
+				//return CLIENT_RECV_UNEXCEPETD_MSG_TYPE_ERR;
+				co_return ERROR;
+		}
 	}
-	return rtnval;
 }
 
 /*************************************************************************
-*  Function name: Client::nego_obj_opt2bits
-*  Description: Conversion function from Objective_Option to bits
-*  Parameter: 	const void* opt_data	//pointer to Objective_Option
-*  				uint16_t data_size	//size of Objective_Option
-*  Return: 		uint16_t *				//pointer to bits
+*  Function name: Client::negotiate
+*  Description: Function for synchronize in class Client, a specific kind of negotiation in which loop count equals 1
+*  Parameter: 	const void * buffer_obj	//pointer to synchronize objective, a C string
+*  Return: 		ERRNO
 *  Remark:
 *  Lastly modified by Kangning Xu on 15-5-25
 *************************************************************************/
-uint16_t * Client::nego_obj_opt2bits(const void* opt_data, uint16_t data_size)
+ERRNO Client::synchronize(const void* buffer_obj)
 {
-	Objective_Option nego_obj_opt(Negotiation, data_size, (uint8_t*)opt_data, loop_count, flag);
-	return nego_obj_opt.to_bits();
+	return synchronize(buffer_obj, strlen((char*)buffer_obj));
 }
 
 /*************************************************************************
-*  Function name: Client::negotiate
+*  Function name: Client::synchronize
 *  Description: Function for synchronize in class Client, a specific kind of negotiation in which loop count equals 1
 *  Parameter: 	const void * buffer_obj	//pointer to synchronize objective
+*  				uint16_t value_len		//length of the objective in octets
 *  Return: 		ERRNO
-*  Remark:
-*  Lastly modified by Kangning Xu on 15-5-25
+*  Remark:for objective values that are not C strings
+*  Modification record:
 *************************************************************************/
-ERRNO Client::synchronize(const void* buffer_obj)
+ERRNO Client::synchronize(const void* buffer_obj, uint16_t value_len)
 {
 	std::cout << "Synchronizing start!" << std::endl;
 	ERRNO rtnval;
@@ -403,27 +460,34 @@ ERRNO Client::synchronize(const void* buffer_obj)
 		return ERROR;
 	}
 
-	session_id= generate_random()%(MAX_SESSION_ID+1);
+	if(UniqueSessionId::allocate(session_id) != SUCCESS)
+	{
+		dieWithUserMessager("no free session id");
+		return ERROR;
+	}
 	loop_count = 1;
 	flag = 0;
 
-	uint16_t value_len = strlen((char*)buffer_obj);
-	Objective_Option obj_opt(Synchronization, value_len, (uint8_t*)buffer_obj,loop_count,flag);
-	uint16_t * bits = obj_opt.to_bits();
-
+	Objective_Option obj_opt(Synchronization, value_len, (uint8_t*)buffer_obj,loop_count,flag,objective_code);
 
 	char buffer[MAXSTRINGLENGTH];
-
-	memcpy(buffer,(char *)bits,value_len + Objective_Option::len_except_value);
+	uint16_t bits_size = obj_opt.to_bits(buffer, sizeof(buffer));
+	if(bits_size == 0)
+	{
+		UniqueSessionId::release(session_id);
+		return OPTIONS_TOO_LONG_ERR;
+	}
 
 	//to avoid bed influence from running nego_thread
 	cur_states = OFF;
 
 	//nego: only once
-	rtnval = send_tcp(buffer,MAXSTRINGLENGTH,REQUEST_MSG);
+	rtnval = send_tcp(buffer,bits_size,REQUEST_MSG);
+	UniqueSessionId::release(session_id);
 
 	//give result to upper through recved_obj_opt
-	Objective_Option recved_obj_opt = Objective_Option::parse_bits((uint16_t *)buffer);
+	OptionView recved_obj_opt;
+	recved_obj_opt.parse(buffer, sizeof(buffer));
 	//option_type obj_opt_type = recved_obj_opt.get_type();
 	//uint16_t obj_opt_len = recved_obj_opt.get_len();
 	//uint8_t * obj_opt_vlaue = recved_obj_opt.get_value();
@@ -432,6 +496,6 @@ ERRNO Client::synchronize(const void* buffer_obj)
 	cur_states = OFF;
 
 	std::cout << "Synchronizing end!" << std::endl;
-	do_configuration(recved_obj_opt.get_value());
+	do_configuration_encoded(recved_obj_opt.get_value(), recved_obj_opt.get_len());
 	return rtnval;
 }
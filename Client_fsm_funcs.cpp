@@ -23,8 +23,11 @@
 */
 
 #include "Client.h"
+#include "TimerWheel.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <errno.h>
 
 
 /*************************************************************************
@@ -124,40 +127,52 @@ ERRNO Client::send_in_INFORMED(const void* buffer,size_t buffer_size,enum MSG_TY
 *  Description: receive a message in time
 *  Parameter: 	const void* buffer	//store data of received message
 					enum MSG_TYPE &type	//store type of received message
-					struct timeval tv	//time limit
+					int timeout_ms	//time limit in milliseconds
 *  Return: ERRNO
-*  Remark:
+*  Remark: the limit is a deadline, messages of other sessions are skipped without extending it
 *  Modification record:
 *  Lastly modified by Kangning Xu on 15-04-29
 *************************************************************************/
-ERRNO Client::recv_in_time(const void* buffer,enum MSG_TYPE &type,struct timeval tv){
-    fd_set readfd;
-    FD_ZERO(&readfd);
-    FD_SET(udp_sock, &readfd);
-    int rtnval = select(udp_sock+1, &readfd, NULL, NULL, &tv);
+ERRNO Client::recv_in_time(const void* buffer,enum MSG_TYPE &type,int timeout_ms){
+    uint64_t deadline = TimerWheel::now_ms() + timeout_ms;
+    for(;;)
+    {
+        uint64_t now = TimerWheel::now_ms();
+        if(now >= deadline){// timeout
+            return TIMEOUT;
+        }
+        struct pollfd pfd;
+        pfd.fd = udp_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rtnval = poll(&pfd, 1, (int)(deadline - now));
 
+        if(rtnval == 0){// timeout
+            return TIMEOUT;
+        }
+        else if(rtnval < 0){// error
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            dieWithUserMessager("poll failed");
+            return SELECT_ERR;
+        }
 
-    if(rtnval == 0){// timeout
-        return TIMEOUT;
-    }
-    else if(rtnval < 0){// error
-        dieWithUserMessager("select failed");
-        return SELECT_ERR;
-    }
-    else{
         uint32_t actual_session_id;
         struct sockaddr_in6 fromAddr;
         size_t buffer_size;
         //receive pdu
-        ERRNO rtnval = recv_pdu((char*)buffer,buffer_size,type,fromAddr,actual_session_id);
-        if(rtnval != SUCCESS)
+        ERRNO recv_rtnval = recv_pdu((char*)buffer,buffer_size,type,fromAddr,actual_session_id);
+        if(recv_rtnval != SUCCESS)
         {
-            return rtnval;
+            return recv_rtnval;
         }
+        recv_size = buffer_size;
 
         if(actual_session_id != session_id){
-            dieWithUserMessager("session_id not match");
-            return CLIENT_RECV_NOMATCHED_SESSION_ID_ERR;
+            // a message of another session, wait on for the rest of the time
+            continue;
         }
 
 
@@ -167,9 +182,7 @@ ERRNO Client::recv_in_time(const void* buffer,enum MSG_TYPE &type,struct timeval
         //   return UNEXCEPTE_SERVER_SOCKADDR;
         //}
         return SUCCESS;
-
     }
-
 }
 
 
@@ -184,7 +197,7 @@ ERRNO Client::recv_in_time(const void* buffer,enum MSG_TYPE &type,struct timeval
 *  Lastly modified by Kangning Xu on 15-04-29
 *************************************************************************/
 ERRNO Client::recv_in_WAIT_RESPONSE(const void* buffer,enum MSG_TYPE &type){
-    ERRNO rtnval = recv_in_time(buffer, type,response_timer);
+    ERRNO rtnval = recv_in_time(buffer, type,response_timeout_ms);
 
     if(rtnval == SUCCESS){
         switch (type) {
@@ -232,7 +245,7 @@ ERRNO Client::recv_in_WAIT_RESPONSE(const void* buffer,enum MSG_TYPE &type){
 *  Lastly modified by Kangning Xu on 15-04-29
 *************************************************************************/
 ERRNO Client::recv_in_WAIT(const void*buffer, enum MSG_TYPE &type){
-    ERRNO rtnval = recv_in_time(buffer, type,wait_timer);
+    ERRNO rtnval = recv_in_time(buffer, type,wait_timeout_ms);
     // receive a pdu
     if(rtnval == SUCCESS){
         switch (type) {
@@ -0,0 +1,251 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[DiscoveryCache.cpp]
+* Description:Implementation of class DiscoveryCache
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "DiscoveryCache.h"
+#include "Option.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+/*************************************************************************
+*  Function name: DiscoveryCache::DiscoveryCache
+*  Description: constructor, no address is known and discoveries are not answered
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+DiscoveryCache::DiscoveryCache()
+{
+    current = new snapshot;
+    current->fallback = -1;
+    pthread_mutex_init(&lock, NULL);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::~DiscoveryCache
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark: no reader may be active
+*  Modification record:
+*************************************************************************/
+DiscoveryCache::~DiscoveryCache()
+{
+    delete current;
+    pthread_mutex_destroy(&lock);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::set_addresses
+*  Description: replace the local addresses and build the responses for them
+*  Parameter: addrs
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void DiscoveryCache::set_addresses(const std::vector<local_address> &addrs)
+{
+    pthread_mutex_lock(&lock);
+    this->addrs = addrs;
+    rebuild();
+    pthread_mutex_unlock(&lock);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::set_divert
+*  Description: set the divert policy and build the responses for it
+*  Parameter: locator   where discoveries are diverted to, NULL to answer them with a locator of this node
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void DiscoveryCache::set_divert(const char *locator)
+{
+    pthread_mutex_lock(&lock);
+    divert = locator != NULL ? locator : "";
+    rebuild();
+    pthread_mutex_unlock(&lock);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::find
+*  Description: the response to a discovery that came in on an interface
+*  Parameter: ifindex   0 when not known
+*  Return: const discovery_response*   NULL when there is nothing to answer with
+*  Remark: call between read_lock() and read_unlock()
+*  Modification record:
+*************************************************************************/
+const discovery_response* DiscoveryCache::find(unsigned int ifindex)
+{
+    snapshot *s = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    int pos = ifindex < s->by_ifindex.size() ? s->by_ifindex[ifindex] : -1;
+    if(pos < 0)
+    {
+        pos = s->fallback;
+    }
+    return pos < 0 ? NULL : &s->responses[pos];
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::rebuild
+*  Description: encode a response for every interface with an address and publish them
+*  Parameter: none
+*  Return: void
+*  Remark: lock must be held. An interface answers with its most preferred address,
+*          the fallback with the most preferred address of all
+*  Modification record:
+*************************************************************************/
+void DiscoveryCache::rebuild()
+{
+    snapshot *s = new snapshot;
+    s->fallback = -1;
+
+    // the address each interface answers with, and the one for the fallback
+    std::vector<int> best;
+    int best_all = -1;
+    for(size_t i = 0; i < addrs.size(); i++)
+    {
+        unsigned int ifindex = addrs[i].ifindex;
+        if(ifindex >= best.size())
+        {
+            best.resize(ifindex + 1, -1);
+        }
+        int pref = preference(addrs[i].addr);
+        if(pref < 0)
+        {
+            continue;
+        }
+        if(best[ifindex] < 0 || pref > preference(addrs[best[ifindex]].addr))
+        {
+            best[ifindex] = i;
+        }
+        if(best_all < 0 || pref > preference(addrs[best_all].addr))
+        {
+            best_all = i;
+        }
+    }
+
+    s->by_ifindex.resize(best.size(), -1);
+    for(size_t ifindex = 0; ifindex < best.size(); ifindex++)
+    {
+        if(best[ifindex] < 0)
+        {
+            continue;
+        }
+        discovery_response resp;
+        resp.ifindex = ifindex;
+        if(encode(addrs[best[ifindex]].addr, resp))
+        {
+            if(best[ifindex] == best_all)
+            {
+                s->fallback = s->responses.size();
+            }
+            s->by_ifindex[ifindex] = s->responses.size();
+            s->responses.push_back(resp);
+        }
+    }
+    // a divert does not depend on the addresses, answer with it even without any
+    if(s->fallback < 0 && !divert.empty())
+    {
+        discovery_response resp;
+        resp.ifindex = 0;
+        if(encode(in6addr_any, resp))
+        {
+            s->fallback = s->responses.size();
+            s->responses.push_back(resp);
+        }
+    }
+
+    snapshot *old = __atomic_exchange_n(&current, s, __ATOMIC_ACQ_REL);
+    epoch.retire(old, free_snapshot);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::encode
+*  Description: encode the Locator option for an address, inside a Divert option when diverting
+*  Parameter: addr
+*  	          resp   bits and len are set
+*  Return: bool   false if the option does not fit
+*  Remark: lock must be held
+*  Modification record:
+*************************************************************************/
+bool DiscoveryCache::encode(const struct in6_addr &addr, discovery_response &resp)
+{
+    if(divert.empty())
+    {
+        char host[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &addr, host, sizeof(host));
+        Option locator_option(Locator, strlen(host), (uint8_t*)host);
+        resp.len = locator_option.to_bits(resp.bits, sizeof(resp.bits));
+    }
+    else
+    {
+        uint8_t locator_bits[MAXSTRINGLENGTH];
+        Option locator_option(Locator, divert.size(), (uint8_t*)divert.c_str());
+        uint16_t locator_size = locator_option.to_bits(locator_bits, sizeof(locator_bits));
+        if(locator_size == 0)
+        {
+            return false;
+        }
+        Option divert_option(Divert, locator_size, locator_bits);
+        resp.len = divert_option.to_bits(resp.bits, sizeof(resp.bits));
+    }
+    return resp.len != 0;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::preference
+*  Description: how good an address is as a locator
+*  Parameter: addr
+*  Return: int   higher is better, -1 for addresses never used
+*  Remark: a peer can connect to a link-local locator only on its own link, it has no zone
+*  Modification record:
+*************************************************************************/
+int DiscoveryCache::preference(const struct in6_addr &addr)
+{
+    if(IN6_IS_ADDR_MULTICAST(&addr) || IN6_IS_ADDR_UNSPECIFIED(&addr))
+    {
+        return -1;
+    }
+    if(IN6_IS_ADDR_LOOPBACK(&addr))
+    {
+        return 0;
+    }
+    if(IN6_IS_ADDR_LINKLOCAL(&addr))
+    {
+        return 1;
+    }
+    return 2;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryCache::free_snapshot
+*  Description: free a set of responses retired by rebuild()
+*  Parameter: p
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void DiscoveryCache::free_snapshot(void *p)
+{
+    delete (snapshot*)p;
+}
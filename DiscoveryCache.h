@@ -0,0 +1,84 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[DiscoveryCache.h]
+* Description:Definition of class DiscoveryCache, the RESPONSE_MSG payloads of discovery encoded
+*			ahead of time, one per interface. They are built again only when the local addresses or
+*			the divert policy change; answering a discovery is a lookup by the interface it came in on.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_DiscoveryCache_h
+#define demo_DiscoveryCache_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include "msg.h"
+#include "common_structs.h"
+#include "SessionTable.h"
+
+// option answering the discoveries arriving on an interface
+typedef struct discovery_response{
+    unsigned int ifindex;
+    uint16_t len;
+    uint8_t bits[MAXSTRINGLENGTH];
+}discovery_response;
+
+// readers look responses up without a lock; a change builds a new set of
+// responses, publishes it, and retires the old one through an EpochDomain
+class DiscoveryCache{
+public:
+    DiscoveryCache();
+    ~DiscoveryCache();
+
+    // replace the local addresses, the responses are built again
+    void set_addresses(const std::vector<local_address> &addrs);
+    // divert discoveries to locator, NULL to answer them with a locator of this node
+    void set_divert(const char *locator);
+
+    // response to a discovery that came in on ifindex, NULL if there is none;
+    // call between read_lock() and read_unlock(), the response stays valid until then
+    const discovery_response* find(unsigned int ifindex);
+    int read_lock(){return epoch.enter();}
+    void read_unlock(int slot){epoch.leave(slot);}
+
+private:
+    typedef struct snapshot{
+        std::vector<discovery_response> responses;
+        // position in responses by ifindex, -1 where the interface has no address
+        std::vector<int> by_ifindex;
+        // for interfaces not known, -1 if there is no address at all
+        int fallback;
+    }snapshot;
+
+    snapshot *current;
+    // what the responses are built from, guarded by lock
+    std::vector<local_address> addrs;
+    std::string divert;
+    pthread_mutex_t lock;
+    EpochDomain epoch;
+
+    void rebuild();
+    bool encode(const struct in6_addr &addr, discovery_response &resp);
+    static int preference(const struct in6_addr &addr);
+    static void free_snapshot(void *p);
+};
+
+#endif
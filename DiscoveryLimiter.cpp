@@ -0,0 +1,263 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[DiscoveryLimiter.cpp]
+* Description:Implementation of class DiscoveryLimiter
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "DiscoveryLimiter.h"
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::DiscoveryLimiter
+*  Description: constructor, 5000 responses a second at most and 100 to a source
+*  Parameter: none
+*  Return: none
+*  Remark: the key of the hash is drawn here, from the clock if the kernel has no random bytes
+*  Modification record:
+*************************************************************************/
+DiscoveryLimiter::DiscoveryLimiter()
+{
+    pending.global_rate = 5000;
+    pending.global_burst = 1000;
+    pending.source_rate = 100;
+    pending.source_burst = 100;
+    active = pending;
+    changed = false;
+    pthread_mutex_init(&lock, NULL);
+
+    global.tokens = active.global_burst;
+    global.refilled_us = 0;
+    memset(sources, 0, sizeof(sources));
+    for(int set = 0; set < SOURCE_SETS; set++)
+    {
+        overflow[set].tokens = active.source_burst;
+        overflow[set].refilled_us = 0;
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    if(getrandom(&hash_key, sizeof(hash_key), GRND_NONBLOCK) != (ssize_t)sizeof(hash_key))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        hash_key = ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) ^ (uint64_t)(uintptr_t)this;
+    }
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::~DiscoveryLimiter
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+DiscoveryLimiter::~DiscoveryLimiter()
+{
+    pthread_mutex_destroy(&lock);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::set_limits
+*  Description: change the limits, they apply from the next discovery
+*  Parameter: limits   a rate of 0 is no limit, a burst of 0 is taken as 1
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void DiscoveryLimiter::set_limits(const discovery_limits &limits)
+{
+    pthread_mutex_lock(&lock);
+    pending = limits;
+    if(pending.global_burst == 0)
+    {
+        pending.global_burst = 1;
+    }
+    if(pending.source_burst == 0)
+    {
+        pending.source_burst = 1;
+    }
+    __atomic_store_n(&changed, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::get_limits
+*  Description: the limits last set
+*  Parameter: none
+*  Return: discovery_limits
+*  Remark:
+*  Modification record:
+*************************************************************************/
+discovery_limits DiscoveryLimiter::get_limits()
+{
+    pthread_mutex_lock(&lock);
+    discovery_limits limits = pending;
+    pthread_mutex_unlock(&lock);
+    return limits;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::get_stats
+*  Description: how many discoveries were answered and dropped
+*  Parameter: none
+*  Return: discovery_stats
+*  Remark: each counter is read on its own, they may be a discovery apart
+*  Modification record:
+*************************************************************************/
+discovery_stats DiscoveryLimiter::get_stats()
+{
+    discovery_stats s;
+    s.answered = __atomic_load_n(&stats.answered, __ATOMIC_RELAXED);
+    s.dropped_global = __atomic_load_n(&stats.dropped_global, __ATOMIC_RELAXED);
+    s.dropped_source = __atomic_load_n(&stats.dropped_source, __ATOMIC_RELAXED);
+    return s;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::allow
+*  Description: take a token for a discovery from the bucket of its source, then from the global one
+*  Parameter: source   address the discovery came from
+*  	          now_us   CLOCK_MONOTONIC in microseconds
+*  Return: bool   true to answer it
+*  Remark: a source over its own limit takes nothing from the global bucket, so a single
+*          flooding node does not use up the responses of the others
+*  Modification record:
+*************************************************************************/
+bool DiscoveryLimiter::allow(const struct in6_addr &source, uint64_t now_us)
+{
+    if(__atomic_load_n(&changed, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&lock);
+        active = pending;
+        changed = false;
+        pthread_mutex_unlock(&lock);
+    }
+
+    source_slot *slot = find_source(source, now_us);
+    if(slot == NULL || !take(slot->bucket, active.source_rate, active.source_burst, now_us))
+    {
+        __atomic_add_fetch(&stats.dropped_source, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    if(!take(global, active.global_rate, active.global_burst, now_us))
+    {
+        __atomic_add_fetch(&stats.dropped_global, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    __atomic_add_fetch(&stats.answered, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::find_source
+*  Description: the slot of a source, taken for it if it has none
+*  Parameter: source
+*  	          now_us
+*  Return: source_slot*   NULL if the source has no slot and the overflow bucket of its set is empty
+*  Remark: a source taking a slot starts with a bucket of one token, for the discovery at hand, and
+*          never with the one it evicts, which another source may have drained. Taking a slot costs
+*          a token of the overflow bucket of the set, so sources taking turns in a set get no more
+*          than its rate between them, and the sources holding a slot are evicted no faster
+*  Modification record:
+*************************************************************************/
+DiscoveryLimiter::source_slot* DiscoveryLimiter::find_source(const struct in6_addr &source, uint64_t now_us)
+{
+    size_t index = hash(source);
+    source_slot *set = sources[index];
+    source_slot *victim = NULL;
+    for(int way = 0; way < SOURCE_WAYS; way++)
+    {
+        source_slot &slot = set[way];
+        if(slot.used && memcmp(&slot.addr, &source, sizeof(source)) == 0)
+        {
+            slot.seen_us = now_us;
+            return &slot;
+        }
+        if(victim == NULL || !slot.used || (victim->used && slot.seen_us < victim->seen_us))
+        {
+            victim = &slot;
+        }
+    }
+    if(!take(overflow[index], active.source_rate, active.source_burst, now_us))
+    {
+        return NULL;
+    }
+    victim->used = true;
+    victim->addr = source;
+    victim->seen_us = now_us;
+    victim->bucket.tokens = 1;
+    victim->bucket.refilled_us = now_us;
+    return victim;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::take
+*  Description: refill a bucket for the time gone by and take a token from it
+*  Parameter: bucket
+*  	          rate     tokens a second, 0 for no limit
+*  	          burst    most tokens the bucket holds
+*  	          now_us
+*  Return: bool   false if it had no token
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool DiscoveryLimiter::take(token_bucket &bucket, double rate, unsigned int burst, uint64_t now_us)
+{
+    if(rate <= 0)
+    {
+        return true;
+    }
+    if(now_us > bucket.refilled_us)
+    {
+        bucket.tokens += (now_us - bucket.refilled_us) * rate / 1000000;
+        bucket.refilled_us = now_us;
+    }
+    if(bucket.tokens > burst)
+    {
+        bucket.tokens = burst;
+    }
+    if(bucket.tokens < 1)
+    {
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
+/*************************************************************************
+*  Function name: DiscoveryLimiter::hash
+*  Description: slot of a source address
+*  Parameter: addr
+*  Return: size_t   below SOURCE_SETS
+*  Remark: 64-bit FNV-1a over the 16 bytes from an offset basis mixed with hash_key; the set is
+*          taken from the high half, which depends on every bit of the key
+*  Modification record:
+*************************************************************************/
+size_t DiscoveryLimiter::hash(const struct in6_addr &addr)
+{
+    uint64_t h = 14695981039346656037ull ^ hash_key;
+    for(int i = 0; i < 16; i++)
+    {
+        h ^= addr.s6_addr[i];
+        h *= 1099511628211ull;
+    }
+    return (size_t)(h >> 32) % SOURCE_SETS;
+}
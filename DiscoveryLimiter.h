@@ -0,0 +1,102 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[DiscoveryLimiter.h]
+* Description:Definition of class DiscoveryLimiter, token buckets limiting how many discoveries are
+*			answered: one for every source together and one per source address. A discovery is
+*			answered only when both buckets of its source have a token, otherwise it is counted and dropped.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_DiscoveryLimiter_h
+#define demo_DiscoveryLimiter_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+// responses per second and how many may go at once, rate 0 for no limit
+typedef struct discovery_limits{
+    double global_rate;
+    unsigned int global_burst;
+    double source_rate;
+    unsigned int source_burst;
+}discovery_limits;
+
+// discoveries since the server started
+typedef struct discovery_stats{
+    uint64_t answered;
+    // over the limit of every source together
+    uint64_t dropped_global;
+    // over the limit of their own source
+    uint64_t dropped_source;
+}discovery_stats;
+
+typedef struct token_bucket{
+    double tokens;
+    // CLOCK_MONOTONIC of the last refill in microseconds
+    uint64_t refilled_us;
+}token_bucket;
+
+// allow() is called by one thread only, the one answering discovery; the limits
+// can be set and the counters read from any thread
+class DiscoveryLimiter{
+public:
+    DiscoveryLimiter();
+    ~DiscoveryLimiter();
+
+    void set_limits(const discovery_limits &limits);
+    discovery_limits get_limits();
+    discovery_stats get_stats();
+
+    // take a token for a discovery from source, false when it is to be dropped
+    bool allow(const struct in6_addr &source, uint64_t now_us);
+
+private:
+    // per-source buckets in sets of SOURCE_WAYS picked by the keyed hash of the source; a source
+    // not in its set takes a token of the set's overflow bucket to have the slot seen least
+    // recently, with a bucket of its own, and is dropped while the overflow bucket is empty
+    enum{ SOURCE_SETS = 256, SOURCE_WAYS = 4 };
+    typedef struct source_slot{
+        struct in6_addr addr;
+        bool used;
+        // CLOCK_MONOTONIC of the last discovery from addr
+        uint64_t seen_us;
+        token_bucket bucket;
+    }source_slot;
+
+    // guarded by lock, copied to active by allow() when changed is set
+    discovery_limits pending;
+    bool changed;
+    pthread_mutex_t lock;
+
+    // the limits and buckets of the thread calling allow()
+    discovery_limits active;
+    token_bucket global;
+    source_slot sources[SOURCE_SETS][SOURCE_WAYS];
+    // sources taking a slot in each set, at the rate and burst of a source
+    token_bucket overflow[SOURCE_SETS];
+    // random offset basis of hash(), so a peer cannot tell which sources share a set
+    uint64_t hash_key;
+    discovery_stats stats;
+
+    source_slot* find_source(const struct in6_addr &source, uint64_t now_us);
+    static bool take(token_bucket &bucket, double rate, unsigned int burst, uint64_t now_us);
+    size_t hash(const struct in6_addr &addr);
+};
+
+#endif
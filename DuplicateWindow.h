@@ -0,0 +1,111 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[DuplicateWindow.h]
+* Description:Class template DuplicateWindow, the last CAPACITY messages of a session, each with a
+*			fingerprint of its type, its length and a 64-bit hash of its data. A message matching a
+*			fingerprint is compared with the data kept, and only one equal octet for octet is a
+*			retransmit, so a hash collision never drops a message.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+#ifndef demo_DuplicateWindow_h
+#define demo_DuplicateWindow_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "msg.h"
+
+// CAPACITY must be a power of two; used by one thread at a time
+template<size_t CAPACITY>
+class DuplicateWindow{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+public:
+	DuplicateWindow()
+	{
+		count = 0;
+		next = 0;
+	}
+
+/*************************************************************************
+*  Function name : DuplicateWindow::add
+*  Description : record the fingerprint of a message unless the window holds it already
+*  Parameter:	enum MSG_TYPE type
+*  				const void * data
+*  				size_t len
+*  Return:bool   false for a message in the window, a duplicate
+*  Remark: the oldest message makes room when the window is full; one longer than
+*          MAXSTRINGLENGTH is not kept and never taken for a duplicate
+*  Modification record:
+*************************************************************************/
+	bool add(enum MSG_TYPE type, const void * data, size_t len)
+	{
+		if(len > MAXSTRINGLENGTH)
+		{
+			return true;
+		}
+		fingerprint f;
+		f.type = type;
+		f.len = len;
+		f.hash = hash(data, len);
+		for(size_t i = 0; i < count; i++)
+		{
+			if(prints[i].hash == f.hash && prints[i].len == f.len && prints[i].type == f.type
+			   && memcmp(bytes[i], data, len) == 0)
+			{
+				return false;
+			}
+		}
+		prints[next] = f;
+		memcpy(bytes[next], data, len);
+		next = (next + 1) & (CAPACITY - 1);
+		if(count < CAPACITY)
+		{
+			count++;
+		}
+		return true;
+	}
+
+private:
+	typedef struct fingerprint{
+		uint64_t hash;
+		size_t len;
+		enum MSG_TYPE type;
+	}fingerprint;
+
+	fingerprint prints[CAPACITY];
+	// the data of each message, compared when its fingerprint matches
+	uint8_t bytes[CAPACITY][MAXSTRINGLENGTH];
+	// fingerprints held, and where the next one goes
+	size_t count;
+	size_t next;
+
+	// FNV-1a
+	static uint64_t hash(const void * data, size_t len)
+	{
+		const uint8_t *p = (const uint8_t *)data;
+		uint64_t h = 14695981039346656037ull;
+		for(size_t i = 0; i < len; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+};
+
+#endif
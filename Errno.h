@@ -33,6 +33,24 @@
 #define PROCESSING_TIMEOUT_SECOND 8
 #define END_TIMEOUT_SECOND 20
 
+// the time-outs in milliseconds, the timers use these; each may be set below a second at build time
+#ifndef RESPONSE_TIMEOUT_MS
+#define RESPONSE_TIMEOUT_MS (RESONSE_TIMEOUT_SECOND * 1000)
+#endif
+#ifndef WAIT_TIMEOUT_MS
+#define WAIT_TIMEOUT_MS (WAIT_TIMEOUT_SECOND * 1000)
+#endif
+// longest wait a WAIT_MSG of the server may ask the client for, longer ones are cut to it
+#ifndef WAIT_MSG_MAX_MS
+#define WAIT_MSG_MAX_MS (6 * RESPONSE_TIMEOUT_MS)
+#endif
+#ifndef PROCESSING_TIMEOUT_MS
+#define PROCESSING_TIMEOUT_MS (PROCESSING_TIMEOUT_SECOND * 1000)
+#endif
+#ifndef END_TIMEOUT_MS
+#define END_TIMEOUT_MS (END_TIMEOUT_SECOND * 1000)
+#endif
+
 // error code
 enum ERRNO{
     // send error
@@ -80,6 +98,34 @@ enum ERRNO{
     CLIENT_RECV_NOMATCHED_SESSION_ID_ERR = -21,
 
 	SOCK_NOT_INIT = -22,
+
+    // length field of a received message doesn't match the bytes received
+    MSG_LEN_ERR = -23,
+
+    // every session id is live
+    SESSION_ID_EXHAUSTED_ERR = -24,
+
+    // unknown option type
+    OPTION_TYPE_ERR = -25,
+
+    // option runs past the end of the received data
+    OPTION_LEN_ERR = -26,
+
+    // a stream has not delivered a whole message yet
+    MSG_INCOMPLETE = -27,
+
+    // a session with this id runs on the connection already
+    SESSION_EXISTS_ERR = -28,
+
+    // the code of an objective is taken or reserved
+    OBJECTIVE_EXISTS_ERR = -29,
+
+    // no objective is registered with the code received
+    OBJECTIVE_UNKNOWN_ERR = -30,
+
+    // the objective has as many values with its handler as it allows
+    OBJECTIVE_BUSY_ERR = -31,
+
     ERROR = -1,
     SUCCESS = 1,
 	
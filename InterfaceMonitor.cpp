@@ -0,0 +1,524 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[InterfaceMonitor.cpp]
+* Description:Implementation of class InterfaceMonitor
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "InterfaceMonitor.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+// big enough for the messages of a dump, the kernel sends up to a page at a time
+#define NETLINK_BUFFER_SIZE 16384
+
+/*************************************************************************
+*  Function name: address_less
+*  Description: order of the addresses in a set, by address and then interface
+*  Parameter: a
+*  	          b
+*  Return: bool
+*  Remark:
+*  Modification record:
+*************************************************************************/
+static bool address_less(const local_address &a, const local_address &b)
+{
+    int c = memcmp(&a.addr, &b.addr, sizeof(a.addr));
+    return c < 0 || (c == 0 && a.ifindex < b.ifindex);
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::InterfaceMonitor
+*  Description: constructor, no address is known before start()
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+InterfaceMonitor::InterfaceMonitor()
+{
+    current = new address_set;
+    nl_sock = -1;
+    stop_fd = -1;
+    running = false;
+    on_change = NULL;
+    on_change_arg = NULL;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::~InterfaceMonitor
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark: no reader may be active
+*  Modification record:
+*************************************************************************/
+InterfaceMonitor::~InterfaceMonitor()
+{
+    stop();
+    delete current;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::start
+*  Description: start the thread reading the addresses of this node and following their changes
+*  Parameter: on_change   called on the monitor thread once the addresses are read and after each change,
+*  	                      may be NULL
+*  	          arg
+*  Return: ERRNO   ERROR when the addresses could not be read
+*  Remark: returns at once, the addresses are read on the monitor thread while the caller goes on;
+*          only when the thread cannot be started they are read before it returns
+*  Modification record:
+*************************************************************************/
+ERRNO InterfaceMonitor::start(void (*on_change)(void *), void *arg)
+{
+    this->on_change = on_change;
+    this->on_change_arg = arg;
+
+    // subscribed before the addresses are asked for
+    nl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(nl_sock >= 0)
+    {
+        struct sockaddr_nl local;
+        memset(&local, 0, sizeof(local));
+        local.nl_family = AF_NETLINK;
+        local.nl_groups = RTMGRP_IPV6_IFADDR;
+        if(bind(nl_sock, (struct sockaddr *)&local, sizeof(local)) < 0)
+        {
+            close(nl_sock);
+            nl_sock = -1;
+        }
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if(stop_fd >= 0 && pthread_create(&tid, NULL, run_help, this) == 0)
+    {
+        running = true;
+        return SUCCESS;
+    }
+    if(stop_fd >= 0)
+    {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    if(nl_sock >= 0)
+    {
+        close(nl_sock);
+        nl_sock = -1;
+    }
+    // no thread, the addresses as they are now
+    return read_first() ? SUCCESS : ERROR;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::read_first
+*  Description: read the addresses the first time and publish them
+*  Parameter: none
+*  Return: bool   false when they could not be read
+*  Remark: from rtnetlink when subscribed, with getifaddrs() otherwise; in that case changes
+*          go unnoticed and nl_sock is closed
+*  Modification record:
+*************************************************************************/
+bool InterfaceMonitor::read_first()
+{
+    if(nl_sock >= 0 && dump(addrs) != SUCCESS)
+    {
+        close(nl_sock);
+        nl_sock = -1;
+    }
+    if(nl_sock < 0 && !read_ifaddrs(addrs))
+    {
+        return false;
+    }
+    publish();
+    if(on_change != NULL)
+    {
+        on_change(on_change_arg);
+    }
+    return true;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::stop
+*  Description: stop the monitor thread, the addresses stay as they are
+*  Parameter: none
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void InterfaceMonitor::stop()
+{
+    if(running)
+    {
+        uint64_t one = 1;
+        ssize_t n = write(stop_fd, &one, sizeof(one));
+        (void)n;
+        pthread_join(tid, NULL);
+        running = false;
+    }
+    if(stop_fd >= 0)
+    {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    if(nl_sock >= 0)
+    {
+        close(nl_sock);
+        nl_sock = -1;
+    }
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::is_local
+*  Description: whether an address is one of this node
+*  Parameter: addr
+*  Return: bool
+*  Remark: a binary search, no lock
+*  Modification record:
+*************************************************************************/
+bool InterfaceMonitor::is_local(const struct in6_addr &addr)
+{
+    local_address key;
+    key.ifindex = 0;
+    key.addr = addr;
+    int slot = epoch.enter();
+    address_set *set = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    address_set::iterator it = std::lower_bound(set->begin(), set->end(), key, address_less);
+    bool found = it != set->end() && memcmp(&it->addr, &addr, sizeof(addr)) == 0;
+    epoch.leave(slot);
+    return found;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::addresses
+*  Description: copy the addresses of this node
+*  Parameter: none
+*  Return: std::vector<local_address>   sorted by address
+*  Remark:
+*  Modification record:
+*************************************************************************/
+std::vector<local_address> InterfaceMonitor::addresses()
+{
+    int slot = epoch.enter();
+    std::vector<local_address> copy(*__atomic_load_n(&current, __ATOMIC_ACQUIRE));
+    epoch.leave(slot);
+    return copy;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::dump
+*  Description: ask rtnetlink for all the IPv6 addresses, on a socket of its own
+*  Parameter: set   replaced with the addresses
+*  Return: ERRNO
+*  Remark: the changes the subscribed socket queued meanwhile are applied on top afterwards,
+*          in order, which leaves the set as the kernel has it
+*  Modification record:
+*************************************************************************/
+ERRNO InterfaceMonitor::dump(address_set &set)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(fd < 0)
+    {
+        return ERROR;
+    }
+    struct{
+        struct nlmsghdr nh;
+        struct ifaddrmsg ifa;
+    }req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    req.nh.nlmsg_type = RTM_GETADDR;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.ifa.ifa_family = AF_INET6;
+    if(send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+    {
+        close(fd);
+        return ERROR;
+    }
+
+    address_set fresh;
+    char buffer[NETLINK_BUFFER_SIZE];
+    for(;;)
+    {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if(len < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(len <= 0)
+        {
+            close(fd);
+            return RECV_ERR;
+        }
+        for(struct nlmsghdr *nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, (size_t)len); nh = NLMSG_NEXT(nh, len))
+        {
+            if(nh->nlmsg_type == NLMSG_DONE)
+            {
+                close(fd);
+                set.swap(fresh);
+                return SUCCESS;
+            }
+            if(nh->nlmsg_type == NLMSG_ERROR)
+            {
+                close(fd);
+                return ERROR;
+            }
+            apply(nh, fresh);
+        }
+    }
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::read_ifaddrs
+*  Description: read the IPv6 addresses with getifaddrs(), when rtnetlink is not there
+*  Parameter: set   replaced with the addresses
+*  Return: bool
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool InterfaceMonitor::read_ifaddrs(address_set &set)
+{
+    struct ifaddrs *ifap;
+    if(getifaddrs(&ifap) != 0)
+    {
+        return false;
+    }
+    set.clear();
+    for(struct ifaddrs *ifa = ifap; ifa != NULL; ifa = ifa->ifa_next)
+    {
+        if(ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET6)
+        {
+            continue;
+        }
+        local_address a;
+        a.ifindex = if_nametoindex(ifa->ifa_name);
+        a.addr = ((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+        set.push_back(a);
+    }
+    freeifaddrs(ifap);
+    std::sort(set.begin(), set.end(), address_less);
+    return true;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::apply
+*  Description: apply an address message of rtnetlink to a set
+*  Parameter: nh    RTM_NEWADDR or RTM_DELADDR, other messages are ignored
+*  	          set   kept sorted
+*  Return: bool   whether the set changed
+*  Remark: an address still doing or failing duplicate address detection cannot be used yet,
+*          it counts as not there; the kernel sends RTM_NEWADDR again when that ends
+*  Modification record:
+*************************************************************************/
+bool InterfaceMonitor::apply(const struct nlmsghdr *nh, address_set &set)
+{
+    if(nh->nlmsg_type != RTM_NEWADDR && nh->nlmsg_type != RTM_DELADDR)
+    {
+        return false;
+    }
+    const struct ifaddrmsg *ifa = (const struct ifaddrmsg *)NLMSG_DATA(nh);
+    if(ifa->ifa_family != AF_INET6)
+    {
+        return false;
+    }
+    uint32_t flags = ifa->ifa_flags;
+    const void *address = NULL;
+    const void *local = NULL;
+    int len = IFA_PAYLOAD(nh);
+    for(const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if(rta->rta_type == IFA_ADDRESS && RTA_PAYLOAD(rta) >= sizeof(struct in6_addr))
+        {
+            address = RTA_DATA(rta);
+        }
+        else if(rta->rta_type == IFA_LOCAL && RTA_PAYLOAD(rta) >= sizeof(struct in6_addr))
+        {
+            local = RTA_DATA(rta);
+        }
+        else if(rta->rta_type == IFA_FLAGS && RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+        {
+            memcpy(&flags, RTA_DATA(rta), sizeof(flags));
+        }
+    }
+    // on point-to-point links IFA_ADDRESS is the peer
+    if(local != NULL)
+    {
+        address = local;
+    }
+    if(address == NULL)
+    {
+        return false;
+    }
+
+    local_address a;
+    a.ifindex = ifa->ifa_index;
+    memcpy(&a.addr, address, sizeof(a.addr));
+    bool usable = nh->nlmsg_type == RTM_NEWADDR && (flags & (IFA_F_TENTATIVE | IFA_F_DADFAILED)) == 0;
+
+    address_set::iterator it = std::lower_bound(set.begin(), set.end(), a, address_less);
+    bool present = it != set.end() && !address_less(a, *it);
+    if(usable && !present)
+    {
+        set.insert(it, a);
+        return true;
+    }
+    if(!usable && present)
+    {
+        set.erase(it);
+        return true;
+    }
+    return false;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::publish
+*  Description: make a copy of addrs the one readers see
+*  Parameter: none
+*  Return: void
+*  Remark: the old copy is freed once no reader uses it
+*  Modification record:
+*************************************************************************/
+void InterfaceMonitor::publish()
+{
+    address_set *set = new address_set(addrs);
+    address_set *old = __atomic_exchange_n(&current, set, __ATOMIC_ACQ_REL);
+    epoch.retire(old, free_set);
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::run
+*  Description: loop of the monitor thread, reading the addresses and applying the changes rtnetlink sends
+*  Parameter: none
+*  Return: void
+*  Remark: when the socket overflowed changes were lost, the addresses are asked for again
+*  Modification record:
+*************************************************************************/
+void InterfaceMonitor::run()
+{
+    if(!read_first())
+    {
+        std::cout << "local addresses could not be read" << std::endl;
+        return;
+    }
+    if(nl_sock < 0)
+    {
+        // read with getifaddrs(), nothing to follow
+        return;
+    }
+
+    char buffer[NETLINK_BUFFER_SIZE];
+    for(;;)
+    {
+        struct pollfd fds[2];
+        fds[0].fd = nl_sock;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        if(fds[1].revents != 0)
+        {
+            return;
+        }
+
+        bool changed = false;
+        for(;;)
+        {
+            ssize_t len = recv(nl_sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if(len < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                if(errno == ENOBUFS)
+                {
+                    // changes were dropped, start over from what the kernel has now
+                    if(dump(addrs) == SUCCESS)
+                    {
+                        changed = true;
+                    }
+                    continue;
+                }
+                break;
+            }
+            for(struct nlmsghdr *nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, (size_t)len); nh = NLMSG_NEXT(nh, len))
+            {
+                if(apply(nh, addrs))
+                {
+                    changed = true;
+                }
+            }
+        }
+        if(changed)
+        {
+            publish();
+            if(on_change != NULL)
+            {
+                on_change(on_change_arg);
+            }
+        }
+    }
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::run_help
+*  Description: static function starting the monitor thread
+*  Parameter: arg   point to InterfaceMonitor
+*  Return: void*
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void* InterfaceMonitor::run_help(void *arg)
+{
+    ((InterfaceMonitor *)arg)->run();
+    return NULL;
+}
+
+/*************************************************************************
+*  Function name: InterfaceMonitor::free_set
+*  Description: free a copy of the addresses retired by publish()
+*  Parameter: p
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void InterfaceMonitor::free_set(void *p)
+{
+    delete (address_set *)p;
+}
@@ -0,0 +1,83 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[InterfaceMonitor.h]
+* Description:Definition of class InterfaceMonitor, the IPv6 addresses of this node kept up to date
+*			by a thread listening to rtnetlink. It subscribes to the address changes before it asks
+*			for the addresses, and applies the changes in the order they come, so no change is missed.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_InterfaceMonitor_h
+#define demo_InterfaceMonitor_h
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <vector>
+#include "common_structs.h"
+#include "SessionTable.h"
+#include "Errno.h"
+
+struct nlmsghdr;
+
+// readers use the addresses without a lock, the monitor thread publishes a new
+// sorted copy on every change and retires the old one through an EpochDomain
+class InterfaceMonitor{
+public:
+    InterfaceMonitor();
+    // stops the thread
+    ~InterfaceMonitor();
+
+    // read the addresses and follow their changes on a thread, on_change(arg) runs on it once
+    // they are read and after each change; without rtnetlink the addresses are read once with
+    // getifaddrs() and never change. Returns before the addresses are read
+    ERRNO start(void (*on_change)(void *), void *arg);
+    void stop();
+
+    // whether addr is an address of this node
+    bool is_local(const struct in6_addr &addr);
+    // the addresses of this node now
+    std::vector<local_address> addresses();
+
+private:
+    // sorted by address
+    typedef std::vector<local_address> address_set;
+
+    address_set *current;
+    EpochDomain epoch;
+    // subscribed to the address changes, -1 without rtnetlink
+    int nl_sock;
+    // eventfd stopping the thread
+    int stop_fd;
+    pthread_t tid;
+    bool running;
+    void (*on_change)(void *);
+    void *on_change_arg;
+    // the monitor thread's copy of the addresses
+    address_set addrs;
+
+    bool read_first();
+    ERRNO dump(address_set &set);
+    bool read_ifaddrs(address_set &set);
+    bool apply(const struct nlmsghdr *nh, address_set &set);
+    void publish();
+    void run();
+    static void* run_help(void *arg);
+    static void free_set(void *p);
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[Mailbox.h]
+* Description:Class template Mailbox, a bounded queue any number of threads push to and one thread pops from.
+*			Every cell carries a sequence number telling whether it is free for the push of a given
+*			position or holds the value of a given position, so neither side takes a lock.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+#ifndef demo_Mailbox_h
+#define demo_Mailbox_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CAPACITY must be a power of two
+template<typename T, size_t CAPACITY>
+class Mailbox{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+public:
+	Mailbox()
+	{
+		for(size_t i = 0; i < CAPACITY; i++)
+		{
+			cells[i].seq = i;
+		}
+		push_pos = 0;
+		pop_pos = 0;
+	}
+
+/*************************************************************************
+*  Function name : Mailbox::push
+*  Description : queue a value, from any thread
+*  Parameter:	const T & value
+*  Return:bool   false if the mailbox is full
+*  Remark:
+*  Modification record:
+*************************************************************************/
+	bool push(const T & value)
+	{
+		size_t pos = __atomic_load_n(&push_pos, __ATOMIC_RELAXED);
+		for(;;)
+		{
+			cell *c = &cells[pos & (CAPACITY - 1)];
+			size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0)
+			{
+				// the cell is free for this position, claim the position
+				if(__atomic_compare_exchange_n(&push_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				{
+					c->value = value;
+					// seq_cst, so a consumer going idle after this sees the value
+					__atomic_store_n(&c->seq, pos + 1, __ATOMIC_SEQ_CST);
+					return true;
+				}
+			}
+			else if(diff < 0)
+			{
+				// the value pushed CAPACITY positions earlier is still there
+				return false;
+			}
+			else
+			{
+				// another producer took this position
+				pos = __atomic_load_n(&push_pos, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+/*************************************************************************
+*  Function name : Mailbox::pop
+*  Description : take the oldest value, from the consumer thread only
+*  Parameter:	T & value
+*  Return:bool   false if the mailbox is empty
+*  Remark:
+*  Modification record:
+*************************************************************************/
+	bool pop(T & value)
+	{
+		cell *c = &cells[pop_pos & (CAPACITY - 1)];
+		if(__atomic_load_n(&c->seq, __ATOMIC_SEQ_CST) != pop_pos + 1)
+		{
+			return false;
+		}
+		value = c->value;
+		// free the cell for the push CAPACITY positions later
+		__atomic_store_n(&c->seq, pop_pos + CAPACITY, __ATOMIC_RELEASE);
+		pop_pos++;
+		return true;
+	}
+
+/*************************************************************************
+*  Function name : Mailbox::empty
+*  Description : determine whether a value is ready, from the consumer thread only
+*  Parameter:
+*  Return:bool
+*  Remark:
+*  Modification record:
+*************************************************************************/
+	bool empty()
+	{
+		return __atomic_load_n(&cells[pop_pos & (CAPACITY - 1)].seq, __ATOMIC_SEQ_CST) != pop_pos + 1;
+	}
+
+private:
+	typedef struct cell{
+		size_t seq;
+		T value;
+	}cell;
+
+	cell cells[CAPACITY];
+	size_t push_pos;
+	// only the consumer uses it
+	size_t pop_pos;
+
+	// copying would duplicate values in flight
+	Mailbox(const Mailbox &);
+	Mailbox & operator = (const Mailbox &);
+};
+
+#endif
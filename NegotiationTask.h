@@ -0,0 +1,188 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[NegotiationTask.h]
+* Description:Definition of class NegotiationTask, a negotiation written as a C++20 coroutine.
+*			The coroutine co_awaits NegotiationTask::next_pdu(ms) for the next PDU of its session or
+*			the time-out of the wait, and its driver resumes it with one or the other. It co_awaits
+*			NegotiationTask::completion(flag) for work done elsewhere, the driver resumes it once the
+*			flag is set. The coroutine does no waiting itself, so a suspended negotiation is only its
+*			frame on the heap.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_NegotiationTask_h
+#define demo_NegotiationTask_h
+
+#include <coroutine>
+#include <exception>
+#include "common_structs.h"
+#include "Errno.h"
+
+// what a suspended negotiation is resumed with
+typedef struct pdu_event{
+    // the wait timed out, pdu is NULL
+    bool timed_out;
+    // the PDU of the driver, not copied; valid until the coroutine waits again
+    const content *pdu;
+}pdu_event;
+
+// owns the coroutine frame, it is destroyed with the NegotiationTask
+class NegotiationTask{
+public:
+    struct promise_type{
+        pdu_event event;
+        // time-out of the current wait in milliseconds, 0 for none
+        unsigned int wait_ms;
+        // suspended in a completion rather than a next_pdu
+        bool waiting_completion;
+        ERRNO result;
+
+        promise_type():wait_ms(0),waiting_completion(false),result(ERROR){event.timed_out = false; event.pdu = NULL;}
+        NegotiationTask get_return_object(){return NegotiationTask(std::coroutine_handle<promise_type>::from_promise(*this));}
+        // nothing runs before start()
+        std::suspend_always initial_suspend() noexcept {return std::suspend_always();}
+        // the frame stays until the NegotiationTask is destroyed, so result() can be read
+        std::suspend_always final_suspend() noexcept {return std::suspend_always();}
+        void return_value(ERRNO rtnval){result = rtnval;}
+        void unhandled_exception(){std::terminate();}
+    };
+    typedef std::coroutine_handle<promise_type> handle;
+
+    // co_await next_pdu(ms) in the coroutine, ms 0 waits without time-out;
+    // the event it yields is valid until the next co_await
+    struct next_pdu{
+        unsigned int ms;
+        promise_type *promise;
+
+        explicit next_pdu(unsigned int ms = 0):ms(ms),promise(NULL){}
+        bool await_ready(){return false;}
+        void await_suspend(handle h){promise = &h.promise(); promise->wait_ms = ms;}
+        const pdu_event & await_resume(){return promise->event;}
+    };
+
+    // co_await completion(flag) in the coroutine for work completed from another thread, which
+    // sets *flag and has the driver call resume_completion(); the flag is cleared as it is consumed
+    struct completion{
+        int *flag;
+
+        explicit completion(int *flag):flag(flag){}
+        // completed before the coroutine got to wait
+        bool await_ready(){return __atomic_exchange_n(flag, 0, __ATOMIC_SEQ_CST) != 0;}
+        void await_suspend(handle h){h.promise().wait_ms = 0; h.promise().waiting_completion = true;}
+        void await_resume(){}
+    };
+
+    NegotiationTask():h(NULL){}
+    NegotiationTask(NegotiationTask &&other):h(other.h){other.h = NULL;}
+    NegotiationTask & operator = (NegotiationTask &&other)
+    {
+        if(this != &other)
+        {
+            if(h)
+            {
+                h.destroy();
+            }
+            h = other.h;
+            other.h = NULL;
+        }
+        return *this;
+    }
+    // a negotiation destroyed while suspended is abandoned
+    ~NegotiationTask()
+    {
+        if(h)
+        {
+            h.destroy();
+        }
+    }
+
+/*************************************************************************
+*  Function name : NegotiationTask::start
+*  Description : run the coroutine to its first wait
+*  Parameter:
+*  Return:void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+    void start()
+    {
+        h.resume();
+    }
+
+/*************************************************************************
+*  Function name : NegotiationTask::resume
+*  Description : hand the waiting coroutine its next PDU and run it to its next wait or its end
+*  Parameter:	const content & pdu   must stay as it is until resume() returns
+*  Return:void
+*  Remark: on the thread calling it, never while another thread runs the coroutine
+*  Modification record:
+*************************************************************************/
+    void resume(const content & pdu)
+    {
+        h.promise().event.timed_out = false;
+        h.promise().event.pdu = &pdu;
+        h.resume();
+    }
+
+/*************************************************************************
+*  Function name : NegotiationTask::time_out
+*  Description : tell the waiting coroutine its wait timed out and run it on
+*  Parameter:
+*  Return:void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+    void time_out()
+    {
+        h.promise().event.timed_out = true;
+        h.promise().event.pdu = NULL;
+        h.resume();
+    }
+
+/*************************************************************************
+*  Function name : NegotiationTask::resume_completion
+*  Description : run the coroutine waiting in a completion on, once the completion is consumed
+*  Parameter:
+*  Return:void
+*  Remark: the driver consumes the flag of the completion itself, with an exchange
+*  Modification record:
+*************************************************************************/
+    void resume_completion()
+    {
+        h.promise().waiting_completion = false;
+        h.resume();
+    }
+
+    // the coroutine has returned, or was never created
+    bool done(){return !h || h.done();}
+    // time-out of the wait the coroutine is suspended in, 0 for none
+    unsigned int wait_ms(){return h.promise().wait_ms;}
+    // the coroutine is suspended in a completion
+    bool waiting_completion(){return h && h.promise().waiting_completion;}
+    // what the coroutine returned, once done()
+    ERRNO result(){return h ? h.promise().result : ERROR;}
+
+private:
+    handle h;
+
+    explicit NegotiationTask(handle h):h(h){}
+    NegotiationTask(const NegotiationTask &);
+    NegotiationTask & operator = (const NegotiationTask &);
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract : 	
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ObjectiveCodec.h]
+* Description:Compile-time codecs for typed objective values and class template Typed_Objective_Option.
+*			objective_codec<T> converts a value of type T to and from the value field of an Objective_Option:
+*			  - integers, enums and other trivially copyable fixed-size structs are copied as they are in memory,
+*			    in host order like the rest of the option
+*			  - objective_blob is a non-owning (pointer, length) pair, decoded without copying
+*			  - std::string takes its length from the option, never from strlen
+*			Any other type fails to compile.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+#ifndef OBJECTIVECODEC_H
+#define OBJECTIVECODEC_H
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+#include <type_traits>
+#include "Option.h"
+#include "msg.h"
+
+// byte string objective value, points into the buffer it was decoded from or into memory owned by the ASA
+struct objective_blob
+{
+	const uint8_t * data;
+	uint16_t len;
+};
+
+// no codec for T: the primary template is left undefined
+template<typename T, typename Enable = void>
+struct objective_codec;
+
+// integers, enums and fixed-size structs
+template<typename T>
+struct objective_codec<T, typename std::enable_if<std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value>::type>
+{
+	// write value into buffer, false if buffer is too small
+	static bool encode(const T & value, uint8_t * buffer, uint16_t buffer_size, uint16_t & len)
+	{
+		if(buffer_size < sizeof(T))
+			return false;
+		memcpy(buffer, &value, sizeof(T));
+		len = sizeof(T);
+		return true;
+	}
+	static bool decode(const uint8_t * bits, uint16_t len, T & value)
+	{
+		if(len != sizeof(T))
+			return false;
+		memcpy(&value, bits, sizeof(T));
+		return true;
+	}
+};
+
+template<>
+struct objective_codec<objective_blob>
+{
+	static bool encode(const objective_blob & value, uint8_t * buffer, uint16_t buffer_size, uint16_t & len)
+	{
+		if(buffer_size < value.len)
+			return false;
+		memcpy(buffer, value.data, value.len);
+		len = value.len;
+		return true;
+	}
+	static bool decode(const uint8_t * bits, uint16_t len, objective_blob & value)
+	{
+		value.data = bits;
+		value.len = len;
+		return true;
+	}
+};
+
+template<>
+struct objective_codec<std::string>
+{
+	static bool encode(const std::string & value, uint8_t * buffer, uint16_t buffer_size, uint16_t & len)
+	{
+		if(buffer_size < value.size())
+			return false;
+		memcpy(buffer, value.data(), value.size());
+		len = value.size();
+		return true;
+	}
+	static bool decode(const uint8_t * bits, uint16_t len, std::string & value)
+	{
+		value.assign((const char *)bits, len);
+		return true;
+	}
+};
+
+// an encoded value copied with a zero after it, for the hooks of ASAs taking C strings;
+// encoded values are not terminated, the octet after one may be anything
+struct c_string_value
+{
+	char str[MAXSTRINGLENGTH + 1];
+
+	c_string_value(const uint8_t * value, uint16_t len)
+	{
+		if(len > MAXSTRINGLENGTH)
+			len = MAXSTRINGLENGTH;
+		memcpy(str, value, len);
+		str[len] = '\0';
+	}
+};
+
+// Objective_Option whose value is a T, encoded by objective_codec<T> straight into the caller's buffer
+template<typename T>
+class Typed_Objective_Option
+{
+private:
+	option_type type;
+	// not copied, like the value pointer of Option
+	const T & value;
+	uint8_t loop_count;
+	uint8_t flag;
+	uint8_t code;
+public:
+	Typed_Objective_Option(option_type type, const T & value, uint8_t loop_count, uint8_t flag, uint8_t code = 0)
+	:type(type), value(value), loop_count(loop_count), flag(flag), code(code)
+	{
+	}
+
+	// write the option into buffer, return the octets used, 0 if buffer is too small
+	uint16_t to_bits(void * buffer, size_t buffer_size)
+	{
+		if(buffer_size < (size_t)Objective_Option::len_except_value)
+			return 0;
+		size_t room = buffer_size - Objective_Option::len_except_value;
+		if(room > UINT16_MAX - Objective_Option::len_except_value)
+			room = UINT16_MAX - Objective_Option::len_except_value;
+		uint8_t * bits = (uint8_t *)buffer;
+		uint16_t len;
+		if(!objective_codec<T>::encode(value, bits + Objective_Option::len_except_value, room, len))
+			return 0;
+		Objective_Option::header_to_bits(bits, type, len, loop_count, flag, code);
+		return Objective_Option::len_except_value + len;
+	}
+
+	// decode the value of a parsed option
+	static bool parse(const OptionView & view, T & value)
+	{
+		return objective_codec<T>::decode(view.get_value(), view.get_len(), value);
+	}
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ObjectiveRegistry.cpp]
+* Description:Implementation of class ObjectiveRegistry and of ObjectiveHandler::negotiate_async
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "ObjectiveRegistry.h"
+
+/*************************************************************************
+*  Function name: ObjectiveHandler::negotiate_async
+*  Description: hand a proposed value to the handler, which completes it when it has the value it wants
+*  Parameter: done   the value, where the answer goes and how to complete
+*  Return: void
+*  Remark: default for handlers answering on the session's worker with negotiate_encoded
+*  Modification record:
+*************************************************************************/
+void ObjectiveHandler::negotiate_async(AsaCompletion * done)
+{
+    uint16_t answer_len = done->answer_capacity();
+    ERRNO rtnval = negotiate_encoded(done->value(), done->len(), done->answer(), answer_len);
+    done->complete(rtnval, rtnval == SUCCESS ? answer_len : 0);
+}
+
+/*************************************************************************
+*  Function name: ObjectiveRegistry::ObjectiveRegistry
+*  Description: constructor, no objective is registered
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ObjectiveRegistry::ObjectiveRegistry()
+{
+    for(int i = 0; i < OBJECTIVE_CODES; i++)
+    {
+        entries[i] = NULL;
+    }
+}
+
+/*************************************************************************
+*  Function name: ObjectiveRegistry::~ObjectiveRegistry
+*  Description: destructor, frees the entries but not their handlers
+*  Parameter: none
+*  Return: none
+*  Remark: no session may be using an entry
+*  Modification record:
+*************************************************************************/
+ObjectiveRegistry::~ObjectiveRegistry()
+{
+    for(int i = 0; i < OBJECTIVE_CODES; i++)
+    {
+        delete entries[i];
+    }
+}
+
+/*************************************************************************
+*  Function name: ObjectiveRegistry::add
+*  Description: register the handler of an objective
+*  Parameter: code      high octet of the type of its Objective_Option, 1 to 255
+*  	          name      for the log
+*  	          handler   not owned, it must outlive the registry
+*  	          policy    NULL for the defaults of GDNP
+*  Return: ERRNO   OBJECTIVE_EXISTS_ERR if code is 0 or registered already
+*  Remark: from any thread, also while the server runs
+*  Modification record:
+*************************************************************************/
+ERRNO ObjectiveRegistry::add(uint8_t code, const char *name, ObjectiveHandler *handler, const objective_policy *policy)
+{
+    if(handler == NULL)
+    {
+        return NULL_POINT_ERR;
+    }
+    if(code == 0)
+    {
+        return OBJECTIVE_EXISTS_ERR;
+    }
+
+    objective_entry *entry = new objective_entry;
+    entry->code = code;
+    entry->name = name != NULL ? name : "";
+    entry->handler = handler;
+    entry->in_flight = 0;
+    entry->policy.max_loop_count = 0;
+    entry->policy.processing_timeout_ms = 0;
+    entry->policy.end_timeout_ms = 0;
+    entry->policy.max_in_flight = 0;
+    entry->policy.cache_entries = 0;
+    entry->policy.cache_ttl_ms = 0;
+    if(policy != NULL)
+    {
+        entry->policy = *policy;
+    }
+    if(entry->policy.max_loop_count == 0)
+    {
+        entry->policy.max_loop_count = UINT8_MAX;
+    }
+    if(entry->policy.processing_timeout_ms == 0)
+    {
+        entry->policy.processing_timeout_ms = PROCESSING_TIMEOUT_MS;
+    }
+    if(entry->policy.end_timeout_ms == 0)
+    {
+        entry->policy.end_timeout_ms = END_TIMEOUT_MS;
+    }
+    entry->cache.configure(entry->policy.cache_entries, entry->policy.cache_ttl_ms);
+
+    objective_entry *expected = NULL;
+    if(!__atomic_compare_exchange_n(&entries[code], &expected, entry, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        delete entry;
+        return OBJECTIVE_EXISTS_ERR;
+    }
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: ObjectiveRegistry::begin
+*  Description: count a value going to the handler of an objective
+*  Parameter: entry   NULL for the hooks of ServerMaster
+*  Return: bool   false if the objective has max_in_flight values with its handler already
+*  Remark: every begin() returning true is matched by an end()
+*  Modification record:
+*************************************************************************/
+bool ObjectiveRegistry::begin(objective_entry *entry)
+{
+    if(entry == NULL)
+    {
+        return true;
+    }
+    unsigned int n = __atomic_add_fetch(&entry->in_flight, 1, __ATOMIC_RELAXED);
+    if(entry->policy.max_in_flight != 0 && n > entry->policy.max_in_flight)
+    {
+        __atomic_sub_fetch(&entry->in_flight, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/*************************************************************************
+*  Function name: ObjectiveRegistry::end
+*  Description: the handler of an objective completed a value
+*  Parameter: entry   NULL for the hooks of ServerMaster
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ObjectiveRegistry::end(objective_entry *entry)
+{
+    if(entry != NULL)
+    {
+        __atomic_sub_fetch(&entry->in_flight, 1, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,140 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ObjectiveRegistry.h]
+* Description:Definition of class ObjectiveHandler, the ASA of one objective, and class ObjectiveRegistry,
+*			the handlers of a server by the code of their objective. The code is the high octet of
+*			the type of an Objective_Option, so a session finds the handler of a message by indexing
+*			a table of 256 entries with the code it parsed; code 0 is the objective served by the
+*			hooks of ServerMaster.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_ObjectiveRegistry_h
+#define demo_ObjectiveRegistry_h
+
+#include <stdint.h>
+#include <string>
+#include "ServerSession.h"
+#include "ResultCache.h"
+#include "ObjectiveCodec.h"
+#include "Errno.h"
+
+// codes an objective can have, 0 among them
+#define OBJECTIVE_CODES 256
+
+// limits of an objective, a field left 0 takes the default of GDNP
+typedef struct objective_policy{
+    // most rounds a negotiation of the objective takes, a peer offering more is held to it
+    uint8_t max_loop_count;
+    // while the handler has a value, WAIT_MSG is sent every processing_timeout_ms
+    unsigned int processing_timeout_ms;
+    // how long a session waits for the next message of the peer
+    unsigned int end_timeout_ms;
+    // values with the handler at once, more are declined; 0 for no limit
+    unsigned int max_in_flight;
+    // answers of the handler kept to answer a value proposed again, 0 not to keep any;
+    // each for cache_ttl_ms, 0 until ServerMaster::invalidate_results()
+    unsigned int cache_entries;
+    unsigned int cache_ttl_ms;
+}objective_policy;
+
+// the ASA of an objective, called from the workers of the server, any number at once
+class ObjectiveHandler{
+public:
+    virtual ~ObjectiveHandler(){}
+
+    // the value wanted for a proposed value, see ServerMaster::asa_negotiate_encoded
+    virtual ERRNO negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len) = 0;
+    // whether two values are the same, see ServerMaster::asa_geq_encoded
+    virtual bool geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b) = 0;
+    // hand a value over without waiting for the answer, see ServerMaster::asa_negotiate_async;
+    // by default negotiate_encoded() answers at once
+    virtual void negotiate_async(AsaCompletion * done);
+};
+
+// handler of an objective whose values are of type T, see objective_codec
+template<typename T>
+class Typed_ObjectiveHandler:public ObjectiveHandler{
+public:
+    // whether two values are the same
+    virtual bool asa_geq(const T & value_a, const T & value_b) = 0;
+    // the value wanted for a proposed value
+    virtual T asa_negotiate(const T & value) = 0;
+
+    virtual ERRNO negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len)
+    {
+        T proposed;
+        if(!objective_codec<T>::decode(value, len, proposed))
+            return OPTION_LEN_ERR;
+        T wanted = asa_negotiate(proposed);
+        if(!objective_codec<T>::encode(wanted, answer, answer_len, answer_len))
+            return OPTIONS_TOO_LONG_ERR;
+        return SUCCESS;
+    }
+
+    virtual bool geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b)
+    {
+        T a, b;
+        if(!objective_codec<T>::decode(value_a, len_a, a) || !objective_codec<T>::decode(value_b, len_b, b))
+            return false;
+        return asa_geq(a, b);
+    }
+};
+
+// a registered objective
+typedef struct objective_entry{
+    uint8_t code;
+    std::string name;
+    // not owned
+    ObjectiveHandler *handler;
+    // defaults filled in
+    objective_policy policy;
+    // values with the handler now
+    unsigned int in_flight;
+    // answers of the handler, see objective_policy
+    ResultCache cache;
+}objective_entry;
+
+// an objective is registered once and stays for the life of the registry, so sessions
+// use entries without a lock or a reference
+class ObjectiveRegistry{
+public:
+    ObjectiveRegistry();
+    // the handlers are not deleted
+    ~ObjectiveRegistry();
+
+    // register handler for the objective with code; policy NULL for the defaults.
+    // OBJECTIVE_EXISTS_ERR if code is 0 or taken
+    ERRNO add(uint8_t code, const char *name, ObjectiveHandler *handler, const objective_policy *policy);
+    // the objective with code, NULL if none is registered
+    objective_entry* find(uint8_t code){return __atomic_load_n(&entries[code], __ATOMIC_ACQUIRE);}
+
+    // count a value going to the handler of entry, false if it has max_in_flight already;
+    // NULL stands for the hooks of ServerMaster, which have no limit
+    static bool begin(objective_entry *entry);
+    // the handler completed a value begin() counted
+    static void end(objective_entry *entry);
+
+private:
+    objective_entry *entries[OBJECTIVE_CODES];
+
+    ObjectiveRegistry(const ObjectiveRegistry &);
+    ObjectiveRegistry & operator = (const ObjectiveRegistry &);
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ObjectiveStore.cpp]
+* Description:Implementation of class ObjectiveStore
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "ObjectiveStore.h"
+#include <string.h>
+
+/*************************************************************************
+*  Function name: ObjectiveStore::ObjectiveStore
+*  Description: constructor, nothing is published
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ObjectiveStore::ObjectiveStore()
+{
+    for(int i = 0; i < CODES; i++)
+    {
+        snapshots[i] = NULL;
+        versions[i] = 0;
+    }
+    pthread_mutex_init(&publish_lock, NULL);
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::~ObjectiveStore
+*  Description: destructor, frees the current snapshots
+*  Parameter: none
+*  Return: none
+*  Remark: no reader may be active; the retired snapshots go with the EpochDomain
+*  Modification record:
+*************************************************************************/
+ObjectiveStore::~ObjectiveStore()
+{
+    for(int i = 0; i < CODES; i++)
+    {
+        delete snapshots[i];
+    }
+    pthread_mutex_destroy(&publish_lock);
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::publish
+*  Description: make a value the state of an objective
+*  Parameter: code         the objective, 0 for the hooks of ServerMaster
+*  	          value, len   encoded as on the wire
+*  Return: ERRNO   OPTIONS_TOO_LONG_ERR if len exceeds OBJECTIVE_STORE_VALUE_MAX
+*  Remark: from any thread; a reader sees the old value or the new one, whole
+*  Modification record:
+*************************************************************************/
+ERRNO ObjectiveStore::publish(uint8_t code, const uint8_t *value, uint16_t len)
+{
+    if(value == NULL && len != 0)
+    {
+        return NULL_POINT_ERR;
+    }
+    if(len > OBJECTIVE_STORE_VALUE_MAX)
+    {
+        return OPTIONS_TOO_LONG_ERR;
+    }
+    store_snapshot *snapshot = new store_snapshot;
+    snapshot->len = len;
+    memcpy(snapshot->value, value, len);
+
+    pthread_mutex_lock(&publish_lock);
+    snapshot->version = ++versions[code];
+    replace(code, snapshot);
+    pthread_mutex_unlock(&publish_lock);
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::withdraw
+*  Description: drop the state of an objective
+*  Parameter: code
+*  Return: void
+*  Remark: from any thread
+*  Modification record:
+*************************************************************************/
+void ObjectiveStore::withdraw(uint8_t code)
+{
+    pthread_mutex_lock(&publish_lock);
+    replace(code, NULL);
+    pthread_mutex_unlock(&publish_lock);
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::read
+*  Description: copy the state of an objective
+*  Parameter: code
+*  	          value      where the value is copied
+*  	          capacity   octets value holds
+*  	          len        octets of the value
+*  	          version    of the value copied
+*  Return: bool   false if nothing is published for code or the value exceeds capacity, the outputs are not set then
+*  Remark: takes no lock and never waits for a publisher
+*  Modification record:
+*************************************************************************/
+bool ObjectiveStore::read(uint8_t code, uint8_t *value, uint16_t capacity, uint16_t &len, uint64_t &version)
+{
+    bool found = false;
+    int slot = epochs.enter();
+    store_snapshot *snapshot = __atomic_load_n(&snapshots[code], __ATOMIC_ACQUIRE);
+    if(snapshot != NULL && snapshot->len <= capacity)
+    {
+        memcpy(value, snapshot->value, snapshot->len);
+        len = snapshot->len;
+        version = snapshot->version;
+        found = true;
+    }
+    epochs.leave(slot);
+    return found;
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::version
+*  Description: version of the state of an objective
+*  Parameter: code
+*  Return: uint64_t   0 if nothing is published for code
+*  Remark:
+*  Modification record:
+*************************************************************************/
+uint64_t ObjectiveStore::version(uint8_t code)
+{
+    uint64_t v = 0;
+    int slot = epochs.enter();
+    store_snapshot *snapshot = __atomic_load_n(&snapshots[code], __ATOMIC_ACQUIRE);
+    if(snapshot != NULL)
+    {
+        v = snapshot->version;
+    }
+    epochs.leave(slot);
+    return v;
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::replace
+*  Description: swap in the snapshot of an objective and retire the one it replaces
+*  Parameter: code
+*  	          snapshot   NULL to withdraw
+*  Return: void
+*  Remark: publish_lock must be held
+*  Modification record:
+*************************************************************************/
+void ObjectiveStore::replace(uint8_t code, store_snapshot *snapshot)
+{
+    store_snapshot *old = __atomic_exchange_n(&snapshots[code], snapshot, __ATOMIC_ACQ_REL);
+    if(old != NULL)
+    {
+        epochs.retire(old, free_snapshot);
+    }
+}
+
+/*************************************************************************
+*  Function name: ObjectiveStore::free_snapshot
+*  Description: free a retired snapshot, for EpochDomain
+*  Parameter: p
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ObjectiveStore::free_snapshot(void *p)
+{
+    delete (store_snapshot *)p;
+}
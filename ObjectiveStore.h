@@ -0,0 +1,77 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ObjectiveStore.h]
+* Description:Definition of class ObjectiveStore, the state the ASA publishes for each objective code,
+*			read to answer synchronization. A publish replaces the snapshot of the objective as a
+*			whole, with the next version; readers copy the snapshot they find without a lock and
+*			the one replaced is freed through an EpochDomain once no reader can still see it.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_ObjectiveStore_h
+#define demo_ObjectiveStore_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include "SessionTable.h"
+#include "Option.h"
+#include "msg.h"
+#include "Errno.h"
+
+// longest value published, what fits a NEGO_END_MSG after the option header
+#define OBJECTIVE_STORE_VALUE_MAX (MAXSTRINGLENGTH - Objective_Option::len_except_value)
+
+// the state of an objective at one version, never changed once published
+typedef struct store_snapshot{
+    uint64_t version;
+    uint16_t len;
+    uint8_t value[OBJECTIVE_STORE_VALUE_MAX];
+}store_snapshot;
+
+// any number of readers and publishers at once; publishers serialise among themselves only
+class ObjectiveStore{
+public:
+    ObjectiveStore();
+    ~ObjectiveStore();
+
+    // make value the state of the objective with code, OPTIONS_TOO_LONG_ERR past OBJECTIVE_STORE_VALUE_MAX
+    ERRNO publish(uint8_t code, const uint8_t *value, uint16_t len);
+    // the objective with code has no state any more, synchronization goes to the ASA again
+    void withdraw(uint8_t code);
+    // copy the state of the objective with code; false if none is published or it exceeds capacity
+    bool read(uint8_t code, uint8_t *value, uint16_t capacity, uint16_t &len, uint64_t &version);
+    // version of the state of the objective with code, 0 if none is published
+    uint64_t version(uint8_t code);
+
+private:
+    enum{ CODES = UINT8_MAX + 1 };
+
+    store_snapshot *snapshots[CODES];
+    // last version published per code, kept across withdraw so versions only grow
+    uint64_t versions[CODES];
+    pthread_mutex_t publish_lock;
+    EpochDomain epochs;
+
+    void replace(uint8_t code, store_snapshot *snapshot);
+    static void free_snapshot(void *p);
+
+    ObjectiveStore(const ObjectiveStore &);
+    ObjectiveStore & operator = (const ObjectiveStore &);
+};
+
+#endif
@@ -51,169 +51,164 @@ Option::Option(option_type type, uint16_t len, uint8_t * value)
 *  	             value  uint8_t
 *  	             loop_count  uint8_t
 *  	             flag  uint8_t
+*  	             code  uint8_t   code of the objective, 0 for the one served by the hooks of ServerMaster
 *  Return: none
 *  Remark:
 *  Lastly modified by Cheng Pang on 15-6-3
 *************************************************************************/
-Objective_Option::Objective_Option(option_type type, uint16_t len, uint8_t * value, uint8_t loop_count, uint8_t flag)
+Objective_Option::Objective_Option(option_type type, uint16_t len, uint8_t * value, uint8_t loop_count, uint8_t flag, uint8_t code)
 :Option(type, len, value)
 {
 	this->flag = flag;
+	this->code = code;
 	this->loop_count = loop_count;
 }
 
 /*************************************************************************
 *  Function name: Option::to_bits
 *  Description: make Option into bits of GDNP option format
-*  Parameter: none
-*  Return: uint16_t*
-*  Remark:
+*  Parameter: buffer  void*   where to write the bits
+*  				 buffer_size  size_t   in octets
+*  Return: uint16_t   octets written, 0 if buffer is too small
+*  Remark: the caller owns buffer, nothing is allocated
 *  Lastly modified by Cheng Pang on 15-6-3
 *************************************************************************/
-uint16_t* Option::to_bits()
+uint16_t Option::to_bits(void * buffer, size_t buffer_size)
 {
-	uint16_t * bits = (uint16_t*)malloc(sizeof(uint8_t) * len + len_except_value);
-    memset(bits,0,sizeof(uint8_t) * len + len_except_value);
-    uint16_t type_num = type;
+	uint16_t bits_size = bits_len();
+	if(buffer == NULL || buffer_size < bits_size)
+		return 0;
 
-    *bits |= type_num;
-    *(bits+1) |= len;
-    if(value != NULL)
-    	memcpy(bits+2,value,len);
+	uint8_t * bits = (uint8_t *)buffer;
+	uint16_t type_num = type;
+	memcpy(bits, &type_num, sizeof(type_num));
+	memcpy(bits + 2, &len, sizeof(len));
+	if(value != NULL)
+		memcpy(bits + len_except_value, value, len);
+	else
+		memset(bits + len_except_value, 0, len);
 
-    return bits;
+	return bits_size;
 }
 
 /*************************************************************************
 *  Function name: Obejective_Option::to_bits
 *  Description: make Obejective_Option into bits of GDNP obejective_option format
-*  Parameter: none
-*  Return: uint16_t*
-*  Remark:
+*  Parameter: buffer  void*   where to write the bits
+*  				 buffer_size  size_t   in octets
+*  Return: uint16_t   octets written, 0 if buffer is too small
+*  Remark: the caller owns buffer, nothing is allocated
 *  Lastly modified by Cheng Pang on 15-6-3
 *************************************************************************/
-uint16_t* Objective_Option::to_bits()
+uint16_t Objective_Option::to_bits(void * buffer, size_t buffer_size)
 {
-	uint16_t * bits = (uint16_t*)malloc(sizeof(uint8_t) * len + len_except_value);
-    memset(bits,0,sizeof(uint8_t) * len + len_except_value);
-    uint16_t type_num = type;
+	uint16_t bits_size = bits_len();
+	if(buffer == NULL || buffer_size < bits_size)
+		return 0;
 
-    *bits |= type_num;
-    *(bits+1) |= len;
-    *(bits+2) |= ((uint16_t)loop_count <<  flag_bits_len) | flag;
-    if(value != NULL)
-    	memcpy(bits+3,value,len);
+	uint8_t * bits = (uint8_t *)buffer;
+	header_to_bits(bits, type, len, loop_count, flag, code);
+	if(value != NULL)
+		memcpy(bits + len_except_value, value, len);
+	else
+		memset(bits + len_except_value, 0, len);
 
-    return bits;
+	return bits_size;
 }
 
 /*************************************************************************
-*  Function name: Option::parse_bits
-*  Description: parse bits of GDNP option format
-*  Parameter: bits uint16_t
-*  				 bits_size  size_t   in octets
-*  Return: Option
-*  Remark:
-*  Lastly modified by Cheng Pang on 15-6-3
+*  Function name: Obejective_Option::header_to_bits
+*  Description: write type, len, loop_count and flag in GDNP obejective_option format
+*  Parameter: buffer  void*   at least len_except_value octets
+*  				 type   option_type
+*  				 len     uint16_t  length of the value following, in octets
+*  				 loop_count  uint8_t
+*  				 flag  uint8_t
+*  				 code  uint8_t   code of the objective
+*  Return: void
+*  Remark: shared with Typed_Objective_Option, which encodes the value itself
+*  Modification record:
 *************************************************************************/
-Option Option::parse_bits(uint16_t * bits)
+void Objective_Option::header_to_bits(void * buffer, option_type type, uint16_t len, uint8_t loop_count, uint8_t flag, uint8_t code)
 {
-	uint16_t type_num = *bits;
-	option_type type;
-	switch(type_num)
-	{
-		case 0:
-			type = Divert;
-			break;
-		case 1:
-			type = Accept;
-			break;
-		case 2:
-			type = Decline;
-			break;
-		case 3:
-			type =Waiting_time;
-			break;
-		case 4:
-			type = Locator;
-			break;
-		case 5:
-			type = Discovery;
-			break;
-		case 6:
-			type = Negotiation;
-			break;
-		case 7:
-			type = Synchronization;
-			break;
-	}
-	uint16_t len;
-	len = *(bits+1) ;
-
-	char * data;
-	if(len != 0)
-	{
-		data = (char *)malloc(sizeof(len));
-		strncpy(data, (char*)(bits+2),len);
-	}
-	else
-		data =NULL;
-
-	return Option (type, len, (uint8_t*)data);;
+	uint8_t * bits = (uint8_t *)buffer;
+	uint16_t type_num = ((uint16_t)code << code_bits_shift) | type;
+	uint16_t loop_flag = ((uint16_t)loop_count << flag_bits_len) | flag;
+	memcpy(bits, &type_num, sizeof(type_num));
+	memcpy(bits + 2, &len, sizeof(len));
+	memcpy(bits + 4, &loop_flag, sizeof(loop_flag));
 }
 
 /*************************************************************************
-*  Function name: Obejective_Option::parse_bits
-*  Description: parse bits of GDNP obejective_option format
-*  Parameter: bits uint16_t
-*  				 bits_size  size_t   in octets
-*  Return: Obejective_Option
+*  Function name: OptionView::OptionView
+*  Description: constructor of OptionView, an empty Accept option until parse() is called
+*  Parameter: none
+*  Return: none
 *  Remark:
-*  Lastly modified by Cheng Pang on 15-6-3
+*  Modification record:
 *************************************************************************/
-Objective_Option Objective_Option::parse_bits(uint16_t * bits)
+OptionView::OptionView()
 {
-	uint16_t type_num = *bits;
-	option_type type;
-	switch(type_num)
-	{
-		case 0:
-			type = Divert;
-			break;
-		case 1:
-			type = Accept;
-			break;
-		case 2:
-			type = Decline;
-			break;
-		case 3:
-			type =Waiting_time;
-			break;
-		case 4:
-			type = Locator;
-			break;
-		case 5:
-			type = Discovery;
-			break;
-		case 6:
-			type = Negotiation;
-			break;
-		case 7:
-			type = Synchronization;
-			break;
-	}
-	uint16_t len = *(bits+1) ;
-	uint8_t loop_count = *(bits+2) >> flag_bits_len;
-	uint8_t flag = *(bits+2);
+	value = NULL;
+	type = Accept;
+	len = 0;
+	loop_count = 0;
+	flag = 0;
+	code = 0;
+	objective = false;
+}
 
-	char * data;
-	if(len != 0)
+/*************************************************************************
+*  Function name: OptionView::parse
+*  Description: decode bits of GDNP option or obejective_option format in place
+*  Parameter: bits  const void*   received buffer
+*  				 bits_size  size_t   in octets, length of the received frame
+*  Return: ERRNO
+*  Remark: the option format follows from its type, the value is not copied
+*  Modification record:
+*************************************************************************/
+ERRNO OptionView::parse(const void * bits, size_t bits_size)
+{
+	if(bits == NULL)
+		return NULL_POINT_ERR;
+	if(bits_size < (size_t)Option::len_except_value)
+		return OPTION_LEN_ERR;
+
+	const uint8_t * p = (const uint8_t *)bits;
+	uint16_t type_num;
+	memcpy(&type_num, p, sizeof(type_num));
+	// only objectives have a code
+	uint8_t c = type_num >> Objective_Option::code_bits_shift;
+	type_num &= 0xff;
+	if(type_num > Synchronization || (c != 0 && !is_objective_type((option_type)type_num)))
+		return OPTION_TYPE_ERR;
+	option_type t = (option_type)type_num;
+
+	uint16_t l;
+	memcpy(&l, p + 2, sizeof(l));
+
+	size_t header_len = Option::len_except_value;
+	uint8_t lc = 0;
+	uint8_t f = 0;
+	if(is_objective_type(t))
 	{
-		data = (char *)malloc(sizeof(len));
-		strncpy(data, (char*)(bits+3),len);
+		header_len = Objective_Option::len_except_value;
+		if(bits_size < header_len)
+			return OPTION_LEN_ERR;
+		uint16_t loop_flag;
+		memcpy(&loop_flag, p + 4, sizeof(loop_flag));
+		lc = loop_flag >> Objective_Option::flag_bits_len;
+		f = (uint8_t)loop_flag;
 	}
-	else
-		data =NULL;
+	if(header_len + l > bits_size)
+		return OPTION_LEN_ERR;
 
-	return Objective_Option (type, len, (uint8_t*)data, loop_count, flag);
+	type = t;
+	len = l;
+	loop_count = lc;
+	flag = f;
+	code = c;
+	objective = is_objective_type(t);
+	value = (l != 0) ? p + header_len : NULL;
+	return SUCCESS;
 }
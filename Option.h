@@ -25,6 +25,8 @@
 
 #include <string>
 #include <stdint.h>
+#include <stddef.h>
+#include "Errno.h"
 
 
 
@@ -50,29 +52,71 @@ protected:
 public:
 	Option(option_type type, uint16_t len, uint8_t * value);
 	virtual ~Option(){}
-	uint16_t * to_bits();
-	static Option parse_bits(uint16_t * bits);
+	// write the option into buffer, return the octets used, 0 if buffer is too small
+	virtual uint16_t to_bits(void * buffer, size_t buffer_size);
+	// octets the option occupies in bits
+	virtual uint16_t bits_len(){return len + len_except_value;}
 	option_type get_type(){return type;}
 	uint16_t get_len(){return len;}
 	uint8_t * get_value(){if(value == NULL) return (uint8_t *)""; else return value;}
 	const static int len_except_value = 4;
 };
 
+// the type field of an objective carries its option_type in the low octet and the code of the
+// objective in the high one, 0 for the objective served by the hooks of ServerMaster
 class Objective_Option:public Option
 {
 private:
 	uint8_t loop_count;
 	uint8_t flag;
+	uint8_t code;
 	const static int flag_bits_len = 8;
 public:
-	Objective_Option(option_type type, uint16_t len, uint8_t * value, uint8_t loop_count, uint8_t flag);
-	uint16_t * to_bits();
-	static Objective_Option parse_bits(uint16_t * bits);
+	Objective_Option(option_type type, uint16_t len, uint8_t * value, uint8_t loop_count, uint8_t flag, uint8_t code = 0);
+	virtual uint16_t to_bits(void * buffer, size_t buffer_size);
+	virtual uint16_t bits_len(){return len + len_except_value;}
+	// write the len_except_value octets in front of the value
+	static void header_to_bits(void * buffer, option_type type, uint16_t len, uint8_t loop_count, uint8_t flag, uint8_t code = 0);
 	uint8_t  get_loop_count(){return loop_count;}
 	uint8_t  get_flag(){return flag;}
+	uint8_t  get_code(){return code;}
+	const static int code_bits_shift = 8;
 	const static int len_except_value = 6;
 	void set_loop_count(uint8_t i){loop_count = i;}
 	void set_flag(uint8_t i){flag = i;}
+	void set_code(uint8_t i){code = i;}
+	friend class OptionView;
+};
+
+// non-owning view of an option in a received buffer, decoded in place without copying
+class OptionView
+{
+private:
+	const uint8_t * value;
+	option_type type;
+	uint16_t len;
+	uint8_t loop_count;
+	uint8_t flag;
+	uint8_t code;
+	bool objective;
+public:
+	OptionView();
+	// decode the option at the start of bits, checking it against bits_size
+	ERRNO parse(const void * bits, size_t bits_size);
+	option_type get_type() const {return type;}
+	uint16_t get_len() const {return len;}
+	// points into the parsed buffer, valid as long as that buffer is
+	const uint8_t * get_value() const {if(value == NULL) return (const uint8_t *)""; else return value;}
+	uint8_t get_loop_count() const {return loop_count;}
+	uint8_t get_flag() const {return flag;}
+	// code of the objective, 0 for other options
+	uint8_t get_code() const {return code;}
+	// whether the option has the objective format, with loop_count and flag
+	bool is_objective() const {return objective;}
+	// octets the option occupies in the parsed buffer
+	uint16_t bits_len() const {return len + (objective ? Objective_Option::len_except_value : Option::len_except_value);}
+	// objective options are those naming a GDNP operation
+	static bool is_objective_type(option_type type){return type == Discovery || type == Negotiation || type == Synchronization;}
 };
 
 #endif
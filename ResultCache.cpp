@@ -0,0 +1,260 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ResultCache.cpp]
+* Description:Implementation of class ResultCache
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "ResultCache.h"
+#include <string.h>
+#include <time.h>
+
+/*************************************************************************
+*  Function name: ResultCache::ResultCache
+*  Description: constructor, the cache is off until configure()
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ResultCache::ResultCache()
+{
+    sets = 0;
+    ttl_us = 0;
+    generation = 1;
+    for(int i = 0; i < LOCKS; i++)
+    {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+/*************************************************************************
+*  Function name: ResultCache::~ResultCache
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ResultCache::~ResultCache()
+{
+    for(int i = 0; i < LOCKS; i++)
+    {
+        pthread_mutex_destroy(&locks[i]);
+    }
+}
+
+/*************************************************************************
+*  Function name: ResultCache::configure
+*  Description: size the cache
+*  Parameter: entries   answers kept at most, rounded up to an even power of two; 0 turns the cache off
+*  	          ttl_ms    how long an answer is kept, 0 until invalidate()
+*  Return: void
+*  Remark: before the cache is used
+*  Modification record:
+*************************************************************************/
+void ResultCache::configure(unsigned int entries, unsigned int ttl_ms)
+{
+    sets = 0;
+    if(entries != 0)
+    {
+        sets = 1;
+        while(sets * 2 < entries)
+        {
+            sets *= 2;
+        }
+    }
+    slots.assign(sets * 2, slot());
+    for(size_t i = 0; i < slots.size(); i++)
+    {
+        slots[i].generation = 0;
+    }
+    ttl_us = (uint64_t)ttl_ms * 1000;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/*************************************************************************
+*  Function name: ResultCache::lookup
+*  Description: find the answer cached for a value
+*  Parameter: kind           the option type of the exchange, answers to synchronization and negotiation are apart
+*  	          value, len     the value proposed
+*  	          answer         where the answer is copied
+*  	          capacity       octets answer holds
+*  	          answer_len     octets of the answer
+*  	          same           whether the ASA took the answer for the same as the value
+*  Return: bool   false on a miss, the outputs are not set then
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool ResultCache::lookup(uint8_t kind, const uint8_t *value, uint16_t len, uint8_t *answer, uint16_t capacity, uint16_t &answer_len, bool &same)
+{
+    if(slots.empty() || len > RESULT_CACHE_VALUE_MAX)
+    {
+        return false;
+    }
+    uint64_t h = hash(kind, value, len);
+    size_t set = h & (sets - 1);
+    uint32_t current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    uint64_t now = now_us();
+    bool hit = false;
+
+    pthread_mutex_t *lock = &locks[set % LOCKS];
+    pthread_mutex_lock(lock);
+    for(int way = 0; way < 2; way++)
+    {
+        slot &s = slots[set * 2 + way];
+        if(s.generation == current && s.hash == h && s.kind == kind && s.len == len && (ttl_us == 0 || now < s.expires_us)
+           && memcmp(s.value, value, len) == 0 && s.answer_len <= capacity)
+        {
+            memcpy(answer, s.answer, s.answer_len);
+            answer_len = s.answer_len;
+            same = s.same;
+            hit = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+
+    __atomic_add_fetch(hit ? &stats.hits : &stats.misses, 1, __ATOMIC_RELAXED);
+    return hit;
+}
+
+/*************************************************************************
+*  Function name: ResultCache::store
+*  Description: cache the answer of the ASA to a value
+*  Parameter: ticket                ticket() before the ASA was asked
+*  	          kind                  the option type of the exchange
+*  	          value, len            the value proposed
+*  	          answer, answer_len    what the ASA answered
+*  	          same                  whether the ASA took the answer for the same as the value
+*  Return: void
+*  Remark: takes the empty or expired slot of the set, else the one expiring first
+*  Modification record:
+*************************************************************************/
+void ResultCache::store(uint32_t ticket, uint8_t kind, const uint8_t *value, uint16_t len, const uint8_t *answer, uint16_t answer_len, bool same)
+{
+    if(slots.empty() || len > RESULT_CACHE_VALUE_MAX || answer_len > RESULT_CACHE_VALUE_MAX)
+    {
+        return;
+    }
+    uint64_t h = hash(kind, value, len);
+    size_t set = h & (sets - 1);
+    uint32_t current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if(ticket != current)
+    {
+        // the state of the ASA changed while it answered
+        return;
+    }
+    uint64_t now = now_us();
+
+    pthread_mutex_t *lock = &locks[set % LOCKS];
+    pthread_mutex_lock(lock);
+    slot *victim = NULL;
+    for(int way = 0; way < 2; way++)
+    {
+        slot &s = slots[set * 2 + way];
+        bool live = s.generation == current && (ttl_us == 0 || now < s.expires_us);
+        // the same value again, or room
+        if(!live || (s.hash == h && s.kind == kind && s.len == len && memcmp(s.value, value, len) == 0))
+        {
+            victim = &s;
+            break;
+        }
+        if(victim == NULL || s.expires_us < victim->expires_us)
+        {
+            victim = &s;
+        }
+    }
+    victim->hash = h;
+    victim->generation = current;
+    victim->expires_us = now + ttl_us;
+    victim->kind = kind;
+    victim->same = same;
+    victim->len = len;
+    victim->answer_len = answer_len;
+    memcpy(victim->value, value, len);
+    memcpy(victim->answer, answer, answer_len);
+    pthread_mutex_unlock(lock);
+}
+
+/*************************************************************************
+*  Function name: ResultCache::invalidate
+*  Description: forget every answer
+*  Parameter: none
+*  Return: void
+*  Remark: the slots are left as they are and read as empty, their generation is old
+*  Modification record:
+*************************************************************************/
+void ResultCache::invalidate()
+{
+    __atomic_add_fetch(&generation, 1, __ATOMIC_ACQ_REL);
+}
+
+/*************************************************************************
+*  Function name: ResultCache::get_stats
+*  Description: hits and misses since configure()
+*  Parameter: none
+*  Return: result_cache_stats
+*  Remark:
+*  Modification record:
+*************************************************************************/
+result_cache_stats ResultCache::get_stats()
+{
+    result_cache_stats s;
+    s.hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    s.misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+    return s;
+}
+
+/*************************************************************************
+*  Function name: ResultCache::hash
+*  Description: hash of a value proposed in a kind of exchange
+*  Parameter: kind
+*  	          value, len
+*  Return: uint64_t
+*  Remark: FNV-1a
+*  Modification record:
+*************************************************************************/
+uint64_t ResultCache::hash(uint8_t kind, const uint8_t *value, uint16_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    h ^= kind;
+    h *= 1099511628211ull;
+    for(uint16_t i = 0; i < len; i++)
+    {
+        h ^= value[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/*************************************************************************
+*  Function name: ResultCache::now_us
+*  Description: CLOCK_MONOTONIC in microseconds
+*  Parameter: none
+*  Return: uint64_t
+*  Remark:
+*  Modification record:
+*************************************************************************/
+uint64_t ResultCache::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
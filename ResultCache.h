@@ -0,0 +1,95 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ResultCache.h]
+* Description:Definition of class ResultCache, the answers of the ASA of an objective by the value
+*			proposed, kept for a while so a value proposed again is answered without the ASA. Each
+*			answer is kept with whether the ASA took it for the same as the proposal. The cache holds
+*			a bounded number of answers, each for a bounded time, and forgets them all at once when
+*			the ASA says its state changed.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_ResultCache_h
+#define demo_ResultCache_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+
+// values and answers longer than this are not cached
+#define RESULT_CACHE_VALUE_MAX 256
+
+// lookups since the cache was configured
+typedef struct result_cache_stats{
+    uint64_t hits;
+    uint64_t misses;
+}result_cache_stats;
+
+// answers are found in one of two slots picked by the hash of the value; the slots are
+// guarded by a set of locks, so sessions on different workers rarely wait for each other
+class ResultCache{
+public:
+    ResultCache();
+    ~ResultCache();
+
+    // keep up to entries answers for ttl_ms each, 0 entries turns the cache off;
+    // before any lookup, the cache is not resized while it is in use
+    void configure(unsigned int entries, unsigned int ttl_ms);
+    bool enabled(){return !slots.empty();}
+
+    // the answer cached for a value proposed in a kind of exchange, copied to answer; false if there is none
+    bool lookup(uint8_t kind, const uint8_t *value, uint16_t len, uint8_t *answer, uint16_t capacity, uint16_t &answer_len, bool &same);
+    // taken before the ASA is asked, and given to store() with its answer
+    uint32_t ticket(){return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);}
+    // cache the answer of the ASA to a value, unless invalidate() was called since ticket()
+    void store(uint32_t ticket, uint8_t kind, const uint8_t *value, uint16_t len, const uint8_t *answer, uint16_t answer_len, bool same);
+    // forget every answer, from any thread; the ASA calls running now are not cached
+    void invalidate();
+
+    result_cache_stats get_stats();
+
+private:
+    enum{ LOCKS = 64 };
+    typedef struct slot{
+        uint64_t hash;
+        // invalidations when stored, the slot is empty unless it is the current generation
+        uint32_t generation;
+        uint64_t expires_us;
+        uint8_t kind;
+        bool same;
+        uint16_t len;
+        uint16_t answer_len;
+        uint8_t value[RESULT_CACHE_VALUE_MAX];
+        uint8_t answer[RESULT_CACHE_VALUE_MAX];
+    }slot;
+
+    // two slots per set, sets a power of two
+    std::vector<slot> slots;
+    size_t sets;
+    uint64_t ttl_us;
+    // starts at 1, so slots zeroed are empty
+    uint32_t generation;
+    pthread_mutex_t locks[LOCKS];
+    result_cache_stats stats;
+
+    static uint64_t hash(uint8_t kind, const uint8_t *value, uint16_t len);
+    static uint64_t now_us();
+};
+
+#endif
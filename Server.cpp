@@ -24,11 +24,34 @@
 
 #include "Server.h"
 #include "Option.h"
+#include "UniqueSessionId.h"
 #include <netdb.h>
 #include <algorithm>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <string.h>
+#include <time.h>
+
+/*************************************************************************
+*  Function name: now_us
+*  Description: CLOCK_MONOTONIC in microseconds, for the startup timing
+*  Parameter: none
+*  Return: uint64_t
+*  Remark:
+*  Modification record:
+*************************************************************************/
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 /*************************************************************************
 *  Function name:server_init
@@ -41,24 +64,97 @@
 *************************************************************************/
 ERRNO ServerMaster::server_init()
 {
-	int udp_sock = socket(AF_INET6,SOCK_DGRAM,0);
-	if(udp_sock < 0)
+	int on = 1;
+	// one udp socket for discovery, answered on a thread of its own so that a storm of it
+	// does not hold up the reactors negotiating
+	discovery_sock = socket(AF_INET6,SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+	if(discovery_sock < 0)
 	{
 		dieWithUserMessager("nsocket failed");
+		return ERROR;
+	}
+	setsockopt(discovery_sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+	if(server_udp_init(discovery_sock) != SUCCESS)
+	{
+		dieWithUserMessager("udp bind failed");
+		return BIND_ERR;
 	}
-	server_udp_init(udp_sock);
 
+	for(int i = 0; i < reactor_count; i++)
+	{
+		reactor *r = new reactor;
+		r->sm = this;
+		r->index = i;
+		r->epoll_fd = -1;
+		r->listen_sock = -1;
+		r->wake_fd = -1;
+		r->stop_fd = -1;
+		r->running = false;
+		pthread_mutex_init(&r->conn_lock,NULL);
+		reactors.push_back(r);
+
+		r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if(r->epoll_fd < 0)
+		{
+			dieWithUserMessager("epoll_create1 failed");
+			return ERROR;
+		}
+
+		r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(r->wake_fd < 0)
+		{
+			dieWithUserMessager("eventfd failed");
+			return ERROR;
+		}
+		watch_fd(r, r->wake_fd);
+		r->timers.set_waker(wake_reactor, r);
+
+		r->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(r->stop_fd < 0)
+		{
+			dieWithUserMessager("eventfd failed");
+			return ERROR;
+		}
+		watch_fd(r, r->stop_fd);
+	}
+	mark_startup(&timing.sockets_us);
 
-    int x;
-    x=fcntl(udp_sock,F_GETFL,0);
-    fcntl(udp_sock,F_SETFL,x | O_NONBLOCK);
+	// the sessions run on the pool, it is up before a reactor can start one
+	if(pool.start(worker_count) != SUCCESS)
+	{
+		return ERROR;
+	}
 
-	FD_ZERO(&read_flags);
-	FD_SET(udp_sock,&read_flags);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for(int i = 0; i < reactor_count; i++)
+	{
+		reactor *r = reactors[i];
+		if(pthread_create(&r->tid, NULL,run_help, r) != 0)
+		{
+			dieWithUserMessager("reactor thread failed");
+			return ERROR;
+		}
+		r->running = true;
+		// one reactor per core
+		if(cpus > 1)
+		{
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(i % cpus, &cpuset);
+			pthread_setaffinity_np(r->tid, sizeof(cpuset), &cpuset);
+		}
+	}
+	mark_startup(&timing.reactors_us);
 
+	discovery_stop_fd = eventfd(0, EFD_CLOEXEC);
+	if(discovery_stop_fd < 0 || pthread_create(&discovery_tid, NULL, run_discovery_help, this) != 0)
+	{
+		dieWithUserMessager("discovery thread failed");
+		return ERROR;
+	}
+	discovery_running = true;
 	std::cout << "Server inti" << std::endl;
-	pthread_t tid;
-	pthread_create(&tid, NULL,run_help, this);
+	print_startup_timing();
 	return SUCCESS;
 }
 
@@ -66,25 +162,40 @@ ERRNO ServerMaster::server_init()
 /*************************************************************************
 *  Function name:listen_negotiate
 *  Description:
-*  Parameter:
+*  Parameter:backlog     length of the queue of connections not accepted yet
 *  Return: ERRNO
 *  Remark:
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-5-18
 *************************************************************************/
-ERRNO ServerMaster::listen_negotiate()
+ERRNO ServerMaster::listen_negotiate(int backlog)
 {
-	ERRNO rtnval;
-	listen_sock = socket(AF_INET6, SOCK_STREAM, 0);
-	if(listen_sock < 0)
+	ERRNO rtnval = SUCCESS;
+	int on = 1;
+	// one listener per reactor, the kernel spreads the connections over them
+	for(size_t i = 0; i < reactors.size(); i++)
 	{
-		dieWithUserMessager("listen socket failed");
-		return ERROR;
+		reactor *r = reactors[i];
+		int sock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(sock < 0)
+		{
+			dieWithUserMessager("listen socket failed");
+			return ERROR;
+		}
+		setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+		rtnval = server_tcp_init(sock, backlog);
+		if(rtnval != SUCCESS)
+		{
+			close(sock);
+			return rtnval;
+		}
+		r->listen_sock = sock;
+		rtnval = watch_fd(r, sock);
+		if(rtnval != SUCCESS)
+		{
+			return rtnval;
+		}
 	}
-	pthread_mutex_lock(&fdset_lock);
-	rtnval = server_tcp_init(listen_sock);
-	pthread_mutex_unlock(&fdset_lock);
-	FD_SET(listen_sock,&read_flags);
 
 	std::cout << "Server listen" << std::endl;
 
@@ -102,8 +213,12 @@ ERRNO ServerMaster::listen_negotiate()
 *************************************************************************/
 ERRNO ServerMaster::stop_negotiate()
 {
-	close_tcp();
-	close(listen_sock);
+	for(size_t i = 0; i < reactors.size(); i++)
+	{
+		// closing also takes it out of the epoll set
+		close(reactors[i]->listen_sock);
+		reactors[i]->listen_sock = -1;
+	}
 	return SUCCESS;
 }
 
@@ -111,47 +226,32 @@ ERRNO ServerMaster::stop_negotiate()
 /*************************************************************************
 *  Function name:ServerMaster
 *  Description:constructor of ServerMaster
-*  Parameter:manager      the Manager of this ServerMaster
-              serverIP
-              serverPort
-              nsock	      socket id
+*  Parameter:reactor_count   number of reactor threads, 0 for one per online core
+*  	         worker_count    number of threads running the sessions, 0 for one per online core
 *  Return: none
 *  Remark:
 *  Modification record: some initiation move to server_init()
 *  Lastly modified by Cheng Pang on 15-5-19
 *************************************************************************/
-ServerMaster::ServerMaster():BaseNegotiator()
+ServerMaster::ServerMaster(int reactor_count, int worker_count):BaseNegotiator()
 {
-	pthread_mutex_init(&fdset_lock,NULL);
-	listen_sock = -1;
-	tcp_accepted = 0;
-    // store global IP address of your interface
-    struct ifaddrs *ifap;
-    if(getifaddrs(&ifap) == 0)
+	this->worker_count = worker_count;
+	if(reactor_count <= 0)
+	{
+		reactor_count = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	this->reactor_count = reactor_count > 0 ? reactor_count : 1;
+	constructed_us = now_us();
+	memset(&timing, 0, sizeof(timing));
+	discovery_sock = -1;
+	discovery_stop_fd = -1;
+	discovery_running = false;
+    // addresses of your interfaces, read in the background while server_init() opens the sockets;
+    // the discovery responses are encoded for them once read and whenever they change
+    if(interfaces.start(interfaces_changed, this) != SUCCESS)
     {
-        for(;ifap != NULL;ifap = ifap->ifa_next)
-        {
-            if (ifap->ifa_addr == NULL){
-                continue;
-            }
-            if(ifap->ifa_addr->sa_family == AF_INET6){
-                char host[IP_str_len];
-                int rtnval = getnameinfo(ifap->ifa_addr,sizeof(struct sockaddr_in6),host, IP_str_len, NULL, 0, 0);
-                if (rtnval == 0)
-                {
-                    char* p = strchr(host,'%');
-                    if(p != NULL){
-                        *p = '\0';
-                    }
-                    std::string s(host);
-                    local_interfaces.push_back(s);
-//                    std::cout  << s << std::endl;
-                }
-            }
-        }// end for
-
+        dieWithUserMessager("no local addresses");
     }
-    freeifaddrs(ifap);
 }
 
 /*************************************************************************
@@ -159,18 +259,72 @@ ServerMaster::ServerMaster():BaseNegotiator()
 *  Description:destructor of ServerMaster
 *  Parameter:none
 *  Return:none
-*  Remark:
+*  Remark: stop() has run already if the class of the ASA called it, as it should
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
 ServerMaster::~ServerMaster(){
 		//std::cout<<"running SM's destruct function"<<std::endl;
+	// the hooks are those of ServerMaster by now, the ASA's are gone with its class
+	stop();
+	for(size_t i = 0; i < reactors.size(); i++)
+	{
+		reactor *r = reactors[i];
+		// the sessions the peers left unfinished, and their timers, which will not fire any more;
+		// the last reference retires each, and the retired ones are deleted while the reactor is whole
+		std::vector<ServerSession*> unfinished;
+		r->sessions.remove_all(unfinished);
+		for(size_t k = 0; k < unfinished.size(); k++)
+		{
+			unfinished[k]->abandon();
+		}
+		r->sessions.flush();
+		for(size_t fd = 0; fd < r->connections.size(); fd++)
+		{
+			if(r->connections[fd] != NULL)
+			{
+				free_connection(r, r->connections[fd]);
+			}
+		}
+		int fds[] = {r->listen_sock, r->wake_fd, r->stop_fd, r->epoll_fd};
+		for(size_t k = 0; k < sizeof(fds) / sizeof(fds[0]); k++)
+		{
+			if(fds[k] >= 0)
+			{
+				close(fds[k]);
+			}
+		}
+		pthread_mutex_destroy(&r->conn_lock);
+		delete r;
+	}
+}
+
+/*************************************************************************
+*  Function name: stop
+*  Description: stop answering discovery and negotiation, and drain the sessions and the ASA
+*  Parameter: none
+*  Return: void
+*  Remark: the values still with the ASA are completed and the steps they queue run before it
+*          returns, so a class overriding the hooks calls it in its destructor, while they are
+*          still its own; once or more, from a thread of the application, not from a hook
+*  Modification record:
+*************************************************************************/
+void ServerMaster::stop()
+{
+	stop_discovery();
+	interfaces.stop();
+	// no reactor may be running once its connections and the reactor itself are freed,
+	// nor submit to the pool once it is stopped
+	stop_reactors();
+	// the steps still queued run to their end, they may use the reactors' timers and connections,
+	// and the values still with the ASA are waited for, their completion queues a step too
+	pool.stop();
 }
 
 /*************************************************************************
 *  Function name:run_help
 *  Description:statc function for a new thread
-*  Parameter:none
+*  Parameter:arg   the reactor to run
 *  Return: void
 *  Remark:
 *  Modification record:
@@ -178,145 +332,707 @@ ServerMaster::~ServerMaster(){
 *************************************************************************/
 void* ServerMaster::run_help(void *arg)
 {
-	ServerMaster* sm =  (ServerMaster*)arg;
-	sm->run();
+	reactor* r =  (reactor*)arg;
+	r->sm->run(r);
 	 return 0;
 }
 /*************************************************************************
 *  Function name: run
 *  Description:Server listens and receive asynchronously for any message
-*  Parameter:none
+*  Parameter:r     the reactor, one per thread
 *  Return:void
-*  Remark:
+*  Remark:a reactor only touches its own sockets, connections and sessions; returns when
+*         stop_reactors() signals r->stop_fd
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-5-19
 *************************************************************************/
-void ServerMaster::run()
+void ServerMaster::run(reactor* r)
 {
-	int flag;
-	struct timeval wait_t;
+	struct epoll_event events[REACTOR_EVENTS];
 
-//	char buffer[MAXSTRINGLENGTH] = {0};
-//					uint32_t session_id;
-//					enum MSG_TYPE type;
-//					size_t buffer_size;
-//					struct sockaddr_in6 client_addr;
-//	 std::cout << "recving .." << std::endl;
-//	 recv_pdu((char*)buffer,buffer_size,type, client_addr, session_id);
-//	 std::cout << type << std::endl;
-//    return;
 	while(1)
 	{
-		if(udp_sock == -1) continue;
-		pthread_mutex_lock(&fdset_lock);
-		wait_t.tv_sec=2;
-		wait_t.tv_usec=0;
-		FD_ZERO(&read_flags);
-		FD_SET(udp_sock,&read_flags);
-		if(listen_sock != -1)
-			FD_SET(listen_sock,&read_flags);
-		for(int i = 0; i < tcp_accepted ; i++)
-		{
-			FD_SET(tcp_fd_set[i],&read_flags);
-		}
-		flag=select(FD_SETSIZE, &read_flags,NULL,NULL,&wait_t);
-		pthread_mutex_unlock(&fdset_lock);
-		if(flag==-1)
+		// sleep until the next timer is due
+		int timeout = r->timers.wait_ms();
+		int n = epoll_wait(r->epoll_fd, events, REACTOR_EVENTS, timeout);
+		if(n < 0)
 		{
-			std::cout << "select error" << std::endl;
-		}
-		else if(flag==0)
-		{
-			std::cout << "waiting.." << std::endl;
+			if(errno != EINTR)
+			{
+				std::cout << "epoll_wait error" << std::endl;
+			}
 			continue;
 		}
-		else
+		for(int i = 0; i < n; i++)
 		{
-			pthread_mutex_lock(&fdset_lock);
-			//udp for discovery
-			if(FD_ISSET(udp_sock,&read_flags))
+			int fd = events[i].data.fd;
+			// the server is being destroyed
+			if(fd == r->stop_fd)
+			{
+				return;
+			}
+			//tcp for negotiation
+			else if(fd == r->listen_sock)
+			{
+				accept_connections(r);
+			}
+			// a timer was armed, the timeout is computed again below
+			else if(fd == r->wake_fd)
 			{
-				pthread_mutex_unlock(&fdset_lock);
-				// receive request
-				char buffer[MAXSTRINGLENGTH] = {0};
-				uint32_t session_id;
-				enum MSG_TYPE type;
-				size_t buffer_size;
-				struct sockaddr_in6 client_addr;
-				if(SUCCESS  != recv_pdu((char*)buffer,buffer_size,type, client_addr, session_id))
+				// one read resets the counter
+				uint64_t wakes;
+				if(read(r->wake_fd, &wakes, sizeof(wakes)) < 0)
 				{
-					dieWithUserMessager("recv_pdu failed");
 					continue;
 				}
-
-//				if(check_Addr(client_addr))	// Ignoring broadcast packets from itself
+			}
+			//tcp for negotiation
+			else
+			{
+				// queued output first, reading may drop the connection
+				if(events[i].events & EPOLLOUT)
 				{
-					if(type == DISCOVERY_MSG)
-					{
-						std::cout << "receive a udp packet for discovery" << std::endl<<std::endl;
-						if(true)//not divert
-						{
-							const char *data = local_interfaces[1].c_str();
-							uint16_t value_len = strlen(data)*sizeof(char) ;
-							Option option(Locator, value_len , (uint8_t*)data);
-							uint16_t * bits = option.to_bits();
-							send_pdu(bits, option.get_len() + Option::len_except_value, RESPONSE_MSG, session_id, client_addr);
-
-//							Option recved_opt = Option::parse_bits((uint16_t *)bits);
-//							std::cout <<"type  "<< recved_opt.get_type() <<std::endl
-//										 <<"len  "<< recved_opt.get_len() << std::endl
-//										 <<"value  "<< (char*)recved_opt.get_value() << std::endl << std::endl;
-
-						}
-						else//divert  demo
-						{
-							char *data = (char* )"Other Server Locator value";
-							uint16_t value_len = strlen(data)*sizeof(char) ;
-							Option locator_option(Locator, value_len , (uint8_t*)data);
-
-							Option divert_option(Divert, locator_option.get_len() + Option::len_except_value , (uint8_t*)locator_option.to_bits());
-							uint16_t * bits = divert_option.to_bits();
-							send_pdu(bits, divert_option.get_len() + Option::len_except_value, RESPONSE_MSG, session_id, client_addr);
-						}
-
-					}
-					else
+					connection *conn = find_connection(r, fd);
+					if(conn != NULL)
 					{
-						 dieWithUserMessager("receive a udp packet not for discovery");
+						flush_connection(r, conn);
 					}
 				}
-			}
-			//tcp for negotiation
-			else if(listen_sock != -1 && FD_ISSET(listen_sock, &read_flags))
-			{
-				pthread_mutex_unlock(&fdset_lock);
-				if(tcp_accepted < MAX_CLIENTS_NUM)
+				if(events[i].events & ~EPOLLOUT)
 				{
-					tcp_sock = accept(listen_sock, (struct sockaddr*)NULL, NULL);
-					tcp_fd_set[tcp_accepted++] = tcp_sock;
-					std::cout << "accept a tcp socket" << std::endl;
+					read_connection(r, fd);
 				}
 			}
-			//tcp for negotiation
-			else if(tcp_sock != -1 && FD_ISSET(tcp_sock, &read_flags))
+		}
+		r->timers.expire();
+	}
+}
+
+/*************************************************************************
+*  Function name: wake_reactor
+*  Description: wake a reactor sleeping in epoll_wait
+*  Parameter: arg   the reactor
+*  Return: void
+*  Remark: called by its timer wheel when a timer is armed to expire before the reactor would wake
+*  Modification record:
+*************************************************************************/
+void ServerMaster::wake_reactor(void *arg)
+{
+	reactor *r = (reactor *)arg;
+	uint64_t one = 1;
+	// a full counter already wakes the reactor
+	if(write(r->wake_fd, &one, sizeof(one)) < 0)
+	{
+		return;
+	}
+}
+
+/*************************************************************************
+*  Function name: interfaces_changed
+*  Description: encode the discovery responses for the addresses of this node as they are now
+*  Parameter: arg   the ServerMaster
+*  Return: void
+*  Remark: called by the interface monitor
+*  Modification record:
+*************************************************************************/
+void ServerMaster::interfaces_changed(void *arg)
+{
+	ServerMaster *sm = (ServerMaster *)arg;
+	sm->discovery_cache.set_addresses(sm->interfaces.addresses());
+	sm->mark_startup(&sm->timing.addresses_us);
+}
+
+/*************************************************************************
+*  Function name: mark_startup
+*  Description: record the time a step of the start is done
+*  Parameter: step   a field of timing
+*  Return: void
+*  Remark: only the first time counts, later calls leave it as it is
+*  Modification record:
+*************************************************************************/
+void ServerMaster::mark_startup(uint64_t *step)
+{
+	if(__atomic_load_n(step, __ATOMIC_RELAXED) != 0)
+	{
+		return;
+	}
+	uint64_t expected = 0;
+	uint64_t elapsed = now_us() - constructed_us;
+	// 0 means not done
+	__atomic_compare_exchange_n(step, &expected, elapsed > 0 ? elapsed : 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*************************************************************************
+*  Function name: get_startup_timing
+*  Description: how long each step of the start took, from the construction of ServerMaster
+*  Parameter: none
+*  Return: startup_timing   0 for the steps not done yet
+*  Remark:
+*  Modification record:
+*************************************************************************/
+startup_timing ServerMaster::get_startup_timing()
+{
+	startup_timing t;
+	t.addresses_us = __atomic_load_n(&timing.addresses_us, __ATOMIC_RELAXED);
+	t.sockets_us = __atomic_load_n(&timing.sockets_us, __ATOMIC_RELAXED);
+	t.reactors_us = __atomic_load_n(&timing.reactors_us, __ATOMIC_RELAXED);
+	t.first_discovery_us = __atomic_load_n(&timing.first_discovery_us, __ATOMIC_RELAXED);
+	return t;
+}
+
+/*************************************************************************
+*  Function name: print_startup_timing
+*  Description: print the startup timing report
+*  Parameter: none
+*  Return: void
+*  Remark: server_init() prints it once the reactors run
+*  Modification record:
+*************************************************************************/
+void ServerMaster::print_startup_timing()
+{
+	startup_timing t = get_startup_timing();
+	const char *names[] = {"addresses read", "sockets bound", "reactors running", "first discovery answered"};
+	uint64_t values[] = {t.addresses_us, t.sockets_us, t.reactors_us, t.first_discovery_us};
+	std::cout << "startup timing:" << std::endl;
+	for(int i = 0; i < 4; i++)
+	{
+		std::cout << "  " << names[i] << ": ";
+		if(values[i] == 0)
+			std::cout << "not yet" << std::endl;
+		else
+			std::cout << values[i] << " us" << std::endl;
+	}
+}
+
+/*************************************************************************
+*  Function name: watch_fd
+*  Description: add a socket to the reactor, edge-triggered for reading
+*  Parameter: r
+*             fd
+*  Return:ERRNO
+*  Remark:the socket must be non-blocking and be drained on every event
+*  Modification record:
+*************************************************************************/
+ERRNO ServerMaster::watch_fd(reactor* r, int fd)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = fd;
+	if(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	{
+		dieWithUserMessager("epoll_ctl failed");
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: accept_connections
+*  Description: accept every connection waiting on the listener of a reactor
+*  Parameter:r
+*  Return:void
+*  Remark:accepted sockets are non-blocking and watched by the reactor
+*  Modification record:
+*************************************************************************/
+void ServerMaster::accept_connections(reactor* r)
+{
+	while(1)
+	{
+		int fd = accept4(r->listen_sock, (struct sockaddr*)NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				dieWithUserMessager("accept failed");
+			}
+			return;
+		}
+		connection *conn = new connection;
+		conn->fd = fd;
+		pdu_reader_init(&conn->reader);
+		conn->sessions = 0;
+		conn->closing = false;
+		pthread_mutex_init(&conn->write_lock, NULL);
+		pthread_mutex_lock(&r->conn_lock);
+		if((size_t)fd >= r->connections.size())
+		{
+			r->connections.resize(fd + 1, NULL);
+		}
+		r->connections[fd] = conn;
+		pthread_mutex_unlock(&r->conn_lock);
+		if(watch_fd(r, fd) != SUCCESS)
+		{
+			drop_connection(r, conn);
+			continue;
+		}
+		std::cout << "accept a tcp socket" << std::endl;
+	}
+}
+
+/*************************************************************************
+*  Function name: find_connection
+*  Description: look up an accepted connection by its socket
+*  Parameter: r
+*             fd
+*  Return:connection*   NULL if fd is not an accepted connection
+*  Remark:
+*  Modification record:
+*************************************************************************/
+connection* ServerMaster::find_connection(reactor* r, int fd)
+{
+	connection *conn = NULL;
+	pthread_mutex_lock(&r->conn_lock);
+	if(fd >= 0 && (size_t)fd < r->connections.size())
+	{
+		conn = r->connections[fd];
+	}
+	pthread_mutex_unlock(&r->conn_lock);
+	return conn;
+}
+
+/*************************************************************************
+*  Function name: drop_connection
+*  Description: stop reading a connection, and close it once no session uses it
+*  Parameter: r
+*             conn
+*  Return:void
+*  Remark:called by the reactor; otherwise the last session to end closes it, see clear_when_session_end
+*  Modification record:
+*************************************************************************/
+void ServerMaster::drop_connection(reactor* r, connection* conn)
+{
+	epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	pthread_mutex_lock(&r->conn_lock);
+	conn->closing = true;
+	if(conn->sessions == 0)
+	{
+		free_connection(r, conn);
+	}
+	pthread_mutex_unlock(&r->conn_lock);
+}
+
+/*************************************************************************
+*  Function name: free_connection
+*  Description: close a connection and forget it
+*  Parameter: r
+*             conn
+*  Return:void
+*  Remark:r->conn_lock must be held. The socket is closed only after its slot is cleared,
+*         so a new connection getting the same fd never finds the old entry.
+*  Modification record:
+*************************************************************************/
+void ServerMaster::free_connection(reactor* r, connection* conn)
+{
+	r->connections[conn->fd] = NULL;
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->write_lock);
+	delete conn;
+}
+
+/*************************************************************************
+*  Function name: write_connection
+*  Description: send a PDU on an accepted connection without blocking
+*  Parameter: r
+*             conn
+*             data, data_size
+*             type
+*             session_id
+*  Return:ERRNO   SEND_ERR if the socket failed or CONNECTION_OUT_MAX octets are queued already
+*  Remark:from any thread. The PDU is written at once if nothing is queued before it; the rest of
+*         it is queued, and the reactor writes the queue when the socket is writable again
+*  Modification record:
+*************************************************************************/
+ERRNO ServerMaster::write_connection(reactor* r, connection* conn, const void* data, size_t data_size, enum MSG_TYPE type, uint32_t session_id)
+{
+	msg_header hdr;
+	if(encode_header(&hdr, type, session_id, data_size) != SUCCESS)
+	{
+		return ENCODE_ERR;
+	}
+	size_t total = MSG_HEADER_LEN + data_size;
+	size_t sent = 0;
+	ERRNO rtnval = SUCCESS;
+
+	pthread_mutex_lock(&conn->write_lock);
+	if(conn->out.empty())
+	{
+		struct iovec iov[2];
+		iov[0].iov_base = &hdr;
+		iov[0].iov_len = MSG_HEADER_LEN;
+		iov[1].iov_base = (void*)data;
+		iov[1].iov_len = data_size;
+		ssize_t n;
+		do
+		{
+			n = writev(conn->fd, iov, 2);
+		}while(n < 0 && errno == EINTR);
+		if(n >= 0)
+		{
+			sent = n;
+		}
+		else if(errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			rtnval = SEND_ERR;
+		}
+	}
+	if(rtnval == SUCCESS && sent < total)
+	{
+		if(conn->out.size() + total - sent > CONNECTION_OUT_MAX)
+		{
+			dieWithUserMessager("connection output queue is full");
+			rtnval = SEND_ERR;
+		}
+		else
+		{
+			bool was_empty = conn->out.empty();
+			if(sent < MSG_HEADER_LEN)
 			{
-				pthread_mutex_unlock(&fdset_lock);
-				std::cout << "receive a tcp packet" << std::endl;
-				// receive request
-				char buffer[MAXSTRINGLENGTH] = {0};
-				uint32_t session_id;
-				enum MSG_TYPE type;
-				size_t buffer_size;
-				if(SUCCESS !=read_pdu((char*)buffer, buffer_size, type , session_id))
+				conn->out.insert(conn->out.end(), (char*)&hdr + sent, (char*)&hdr + MSG_HEADER_LEN);
+				sent = MSG_HEADER_LEN;
+			}
+			conn->out.insert(conn->out.end(), (const char*)data + (sent - MSG_HEADER_LEN), (const char*)data + data_size);
+			if(was_empty)
+			{
+				watch_writable(r, conn, true);
+			}
+		}
+	}
+	pthread_mutex_unlock(&conn->write_lock);
+	return rtnval;
+}
+
+/*************************************************************************
+*  Function name: flush_connection
+*  Description: write what a connection has queued
+*  Parameter: r
+*             conn
+*  Return:void
+*  Remark:called by the reactor when the socket is writable; the queue is dropped if the socket failed
+*  Modification record:
+*************************************************************************/
+void ServerMaster::flush_connection(reactor* r, connection* conn)
+{
+	pthread_mutex_lock(&conn->write_lock);
+	size_t sent = 0;
+	while(sent < conn->out.size())
+	{
+		ssize_t n = write(conn->fd, &conn->out[sent], conn->out.size() - sent);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				// the peer is gone, reading the socket finds it and drops the connection
+				sent = conn->out.size();
+			}
+			break;
+		}
+		sent += n;
+	}
+	conn->out.erase(conn->out.begin(), conn->out.begin() + sent);
+	if(conn->out.empty())
+	{
+		watch_writable(r, conn, false);
+	}
+	pthread_mutex_unlock(&conn->write_lock);
+}
+
+/*************************************************************************
+*  Function name: watch_writable
+*  Description: wait, or stop waiting, for a connection to be writable
+*  Parameter: r
+*             conn
+*             writable   true while output is queued
+*  Return:void
+*  Remark:conn->write_lock must be held. Fails harmlessly once the reactor dropped the connection
+*  Modification record:
+*************************************************************************/
+void ServerMaster::watch_writable(reactor* r, connection* conn, bool writable)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET | (writable ? EPOLLOUT : 0);
+	ev.data.fd = conn->fd;
+	epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/*************************************************************************
+*  Function name: read_connection
+*  Description: read what an accepted tcp connection has ready and distribute every whole PDU in it
+*  Parameter: r
+*             tcp_sock   the connection
+*  Return:void
+*  Remark:reads until the socket is drained, as the reactor is edge-triggered; the rest of
+*         a split PDU stays in the connection's reader until the next event.
+*         The connection is dropped when the peer closes it.
+*  Modification record:
+*************************************************************************/
+void ServerMaster::read_connection(reactor* r, int tcp_sock)
+{
+	// only the reactor drops connections, so conn stays valid here
+	connection *conn = find_connection(r, tcp_sock);
+	if(conn == NULL || conn->closing)
+	{
+		return;
+	}
+
+	ERRNO rtnval;
+	while((rtnval = pdu_reader_fill(&conn->reader, tcp_sock)) == SUCCESS)
+	{
+		while(1)
+		{
+			char buffer[MAXSTRINGLENGTH+1];
+			uint32_t session_id;
+			enum MSG_TYPE type;
+			size_t buffer_size;
+			rtnval = pdu_reader_next(&conn->reader, type, session_id, buffer, buffer_size);
+			if(rtnval == MSG_INCOMPLETE)
+			{
+				break;
+			}
+			if(rtnval == MSG_LEN_ERR)
+			{
+				// no way to find the next PDU boundary, let the sessions on it fail fast
+				dieWithUserMessager("tcp stream out of step");
+				shutdown(tcp_sock, SHUT_RDWR);
+				drop_connection(r, conn);
+				return;
+			}
+			if(rtnval != SUCCESS)
+			{
+				dieWithUserMessager("read_pdu failed");
+				continue;
+			}
+			distribute(r, conn, session_id, buffer, buffer_size, type);
+		}
+	}
+	if(rtnval != MSG_INCOMPLETE)
+	{
+		// closed by the peer or failed
+		drop_connection(r, conn);
+	}
+}
+
+/*************************************************************************
+*  Function name: run_discovery_help
+*  Description: static function starting the thread answering discovery
+*  Parameter: arg   point to ServerMaster
+*  Return: void*
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void* ServerMaster::run_discovery_help(void *arg)
+{
+	((ServerMaster *)arg)->run_discovery();
+	return NULL;
+}
+
+/*************************************************************************
+*  Function name: run_discovery
+*  Description: answer discovery until stop_discovery()
+*  Parameter: none
+*  Return: void
+*  Remark: the thread lowers its own priority to DISCOVERY_NICE and is not bound to a core, so when
+*          discovery and negotiation compete for a core the reactor gets it. It sleeps only when the
+*          socket is drained; datagrams coming in faster than it answers wait in the socket buffer
+*          and the kernel drops those that do not fit
+*  Modification record:
+*************************************************************************/
+void ServerMaster::run_discovery()
+{
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), DISCOVERY_NICE);
+
+	bool pending = false;
+	for(;;)
+	{
+		struct pollfd fds[2];
+		fds[0].fd = discovery_sock;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = discovery_stop_fd;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		// with discovery left over only look whether it is time to stop
+		if(poll(fds, 2, pending ? 0 : -1) < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			dieWithUserMessager("poll failed");
+			return;
+		}
+		if(fds[1].revents != 0)
+		{
+			return;
+		}
+		if(pending || fds[0].revents != 0)
+		{
+			pending = answer_discovery();
+		}
+	}
+}
+
+/*************************************************************************
+*  Function name: stop_reactors
+*  Description: stop the reactor threads
+*  Parameter: none
+*  Return: void
+*  Remark: their sockets and connections stay open until the destructor frees them
+*  Modification record:
+*************************************************************************/
+void ServerMaster::stop_reactors()
+{
+	for(size_t i = 0; i < reactors.size(); i++)
+	{
+		reactor *r = reactors[i];
+		if(r->running)
+		{
+			uint64_t one = 1;
+			ssize_t n = write(r->stop_fd, &one, sizeof(one));
+			(void)n;
+			pthread_join(r->tid, NULL);
+			r->running = false;
+		}
+	}
+}
+
+/*************************************************************************
+*  Function name: stop_discovery
+*  Description: stop the thread answering discovery and close the udp socket
+*  Parameter: none
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ServerMaster::stop_discovery()
+{
+	if(discovery_running)
+	{
+		uint64_t one = 1;
+		ssize_t n = write(discovery_stop_fd, &one, sizeof(one));
+		(void)n;
+		pthread_join(discovery_tid, NULL);
+		discovery_running = false;
+	}
+	if(discovery_stop_fd >= 0)
+	{
+		close(discovery_stop_fd);
+		discovery_stop_fd = -1;
+	}
+	if(discovery_sock >= 0)
+	{
+		close(discovery_sock);
+		discovery_sock = -1;
+	}
+}
+
+/*************************************************************************
+*  Function name: answer_discovery
+*  Description: receive the discovery messages waiting on the udp socket and respond to them,
+*  				a batch of PDU_BATCH_SIZE datagrams per recvmmsg() and sendmmsg()
+*  Parameter: none
+*  Return:bool   true if it gave up before the socket was drained, call again then
+*  Remark:gives up after DISCOVERY_BATCHES rounds so that stop_discovery() is noticed.
+*         A discovery over the limits of discovery_limiter is dropped unanswered
+*  Modification record:
+*************************************************************************/
+bool ServerMaster::answer_discovery()
+{
+	enum{ DISCOVERY_BATCHES = 8 };
+
+	msg pdus[PDU_BATCH_SIZE];
+	size_t pdu_sizes[PDU_BATCH_SIZE];
+	struct sockaddr_in6 client_addrs[PDU_BATCH_SIZE];
+	struct in6_pktinfo dest_infos[PDU_BATCH_SIZE];
+	msg_header resp_hdrs[PDU_BATCH_SIZE];
+	const void* resp_data[PDU_BATCH_SIZE];
+	size_t resp_sizes[PDU_BATCH_SIZE];
+	// locators encoded on the spot before the addresses are read
+	uint8_t early_bits[PDU_BATCH_SIZE][Option::len_except_value + INET6_ADDRSTRLEN];
+
+	for(int batch = 0; batch < DISCOVERY_BATCHES; batch++)
+	{
+		int count;
+		if(SUCCESS != recv_pdus(discovery_sock, pdus, pdu_sizes, client_addrs, dest_infos, PDU_BATCH_SIZE, count))
+		{
+			dieWithUserMessager("recv_pdus failed");
+			return false;
+		}
+
+		// the responses are encoded already, only the headers are written here;
+		// they stay valid until the batch is sent
+		int epoch_slot = discovery_cache.read_lock();
+		int resp_count = 0;
+		uint64_t now = now_us();
+		for(int i = 0; i < count; i++)
+		{
+			char buffer[MAXSTRINGLENGTH+1];
+			uint32_t session_id;
+			enum MSG_TYPE type;
+			size_t buffer_size;
+			if(SUCCESS != decode(&pdus[i], pdu_sizes[i], type, session_id, buffer, buffer_size))
+			{
+				continue;
+			}
+//			if(check_Addr(client_addrs[i]))	// Ignoring broadcast packets from itself
+			if(type != DISCOVERY_MSG)
+			{
+				dieWithUserMessager("receive a udp packet not for discovery");
+				continue;
+			}
+			if(!discovery_limiter.allow(client_addrs[i].sin6_addr, now))
+			{
+				continue;
+			}
+			const discovery_response *resp = discovery_cache.find(dest_infos[i].ipi6_ifindex);
+			if(resp != NULL)
+			{
+				encode_header(&resp_hdrs[resp_count], RESPONSE_MSG, session_id, resp->len);
+				resp_data[resp_count] = resp->bits;
+				resp_sizes[resp_count] = resp->len;
+			}
+			else
+			{
+				// the addresses are not read yet, but the one a unicast discovery was sent to is of this node
+				const struct in6_addr *dest = &dest_infos[i].ipi6_addr;
+				if(IN6_IS_ADDR_MULTICAST(dest) || IN6_IS_ADDR_UNSPECIFIED(dest))
 				{
-					dieWithUserMessager("recv_pdu failed");
 					continue;
 				}
-				distribute(session_id, buffer, buffer_size, type);
+				char host[INET6_ADDRSTRLEN];
+				inet_ntop(AF_INET6, dest, host, sizeof(host));
+				Option locator_option(Locator, strlen(host), (uint8_t*)host);
+				uint16_t bits_size = locator_option.to_bits(early_bits[resp_count], sizeof(early_bits[resp_count]));
+				encode_header(&resp_hdrs[resp_count], RESPONSE_MSG, session_id, bits_size);
+				resp_data[resp_count] = early_bits[resp_count];
+				resp_sizes[resp_count] = bits_size;
 			}
+			client_addrs[resp_count] = client_addrs[i];
+			resp_count++;
 		}
 
+		if(resp_count > 0)
+		{
+			std::cout << "receive " << resp_count << " udp packets for discovery" << std::endl<<std::endl;
+			send_pdus(discovery_sock, resp_hdrs, resp_data, resp_sizes, client_addrs, resp_count);
+			mark_startup(&timing.first_discovery_us);
+		}
+		discovery_cache.read_unlock(epoch_slot);
+		if(count < PDU_BATCH_SIZE)
+		{
+			return false;
+		}
 	}
+	return true;
 }
 
 /*************************************************************************
@@ -324,18 +1040,13 @@ void ServerMaster::run()
 *  Description: Ignoring broadcast packets from itself
 *  Parameter: client_addr   a addr to checking not itself
 *  Return: bool  true for not itself
-*  Remark:
+*  Remark: the addresses of this node are followed as they change
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-5-20
 *************************************************************************/
 bool ServerMaster::check_Addr(struct sockaddr_in6 client_addr)
 {
-	char ip[IP_str_len];
-	inet_ntop(AF_INET6, &client_addr.sin6_addr,ip,sizeof(ip));
-	std::string tmp(ip);
-	std::vector<std::string>::iterator iter = find(local_interfaces.begin( ), local_interfaces.end( ), tmp);
-
-	if(iter == local_interfaces.end())
+	if(!interfaces.is_local(client_addr.sin6_addr))
 		return true;
 	else
 	{
@@ -348,7 +1059,8 @@ bool ServerMaster::check_Addr(struct sockaddr_in6 client_addr)
 /*************************************************************************
 *  Function name: distribute
 *  Description: distribute received message to specific thread
-*  Parameter: clientAddr
+*  Parameter: r           reactor of the connection
+*  	          conn        connection the message came from
 *  	          session_id
 *  	          buffer
 *  	          buffer_size
@@ -358,71 +1070,258 @@ bool ServerMaster::check_Addr(struct sockaddr_in6 client_addr)
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
-void ServerMaster::distribute(uint32_t session_id,const void* buffer,size_t buffer_size,enum MSG_TYPE type)
+void ServerMaster::distribute(reactor* r,connection* conn,uint32_t session_id,const void* buffer,size_t buffer_size,enum MSG_TYPE type)
 {
     // value
     content c;
     c.type = type;
     memcpy(c.data, buffer, buffer_size);
+    c.data_len = buffer_size;
+    // keep string values readable by the upper layer
+    if(buffer_size < MAXSTRINGLENGTH)
+    {
+        c.data[buffer_size] = '\0';
+    }
 
-    std::map<uint32_t,ServerSession*>::iterator iter = ss_map.begin();
-
-	while (iter != ss_map.end())
-	{
-		if(iter->first == session_id)
-		{
-			if(type == REQUEST_MSG)
-			{
-					dieWithUserMessager("old session should not send REQUEST_MSG");
-					return;
-			}
-			// push into queue
-            iter->second->queue_push(c);
-            break;
+    int epoch_slot = r->sessions.read_lock();
+    ServerSession *found = r->sessions.find(session_id, conn->fd);
+    if(found != NULL)
+    {
+        if(type == REQUEST_MSG)
+        {
+            r->sessions.read_unlock(epoch_slot);
+            dieWithUserMessager("old session should not send REQUEST_MSG");
+            return;
+        }
+        // push into its mailbox, a step on the pool handles it
+        if(!found->deliver(c))
+        {
+            dieWithUserMessager("session mailbox is full, message dropped");
         }
-        iter++;
     }
+    r->sessions.read_unlock(epoch_slot);
 
-    if(iter == ss_map.end())
+    if(found == NULL)
     {
     	if(type != REQUEST_MSG)
 		{
 				dieWithUserMessager("New session must begin with REQUEST_MSG");
 				return;
 		}
+		// the state the ASA published answers synchronization at once
+		if(answer_sync(r, conn, session_id, c.data, c.data_len))
+		{
+			return;
+		}
 		std::cout<<"start negotiation process"<<std::endl;
 
-        // new SeverSession for processing
-		ServerSession *ss = new ServerSession(this->tcp_sock,session_id,c);
-		// store in ss_map
-		ss_map.insert(std::map<uint32_t, ServerSession*>::value_type(session_id,ss));
+        // mark the id live on this node, unless a local client is using it already
+        bool owns_session_id = UniqueSessionId::reserve(session_id);
 
-        // parameters of threads running function
-        session_run_parms parm;
-        parm.sm = this;
-        parm.ss = ss;
+        // the connection stays open until this session ends
+        pthread_mutex_lock(&r->conn_lock);
+        conn->sessions++;
+        pthread_mutex_unlock(&r->conn_lock);
 
-        // launch the thread
-       pthread_t tid;
-       pthread_create(&tid, NULL, ServerSession::run_help, &parm);
+        // new SeverSession for processing
+		ServerSession *ss = new ServerSession(this,r,conn,session_id,c,owns_session_id);
+		// only this reactor inserts into its table, so the id cannot have been taken since find
+		r->sessions.insert(session_id, conn->fd, ss);
 
+        // run its first step on the pool
+        ss->start();
     }
 }
 
 
+/*************************************************************************
+*  Function name: answer_sync
+*  Description: answer a request to synchronize an objective with the state its ASA published
+*  Parameter: r            reactor of the connection
+*  	          conn         connection the request came from
+*  	          session_id
+*  	          buffer       the request
+*  	          buffer_size
+*  Return: bool   false if the request is not a synchronization, has no loop left or nothing is
+*                 published for its objective, a session handles it then
+*  Remark: runs on the reactor, reads sync_store without a lock and queues the answer without
+*          blocking; the NEGO_END_MSG is the one ServerSession would send, no session is created
+*          and the session id is not reserved
+*  Modification record:
+*************************************************************************/
+bool ServerMaster::answer_sync(reactor* r,connection* conn,uint32_t session_id,const void* buffer,size_t buffer_size)
+{
+	OptionView request;
+	if(request.parse(buffer, buffer_size) != SUCCESS || request.get_type() != Synchronization
+	   || request.get_loop_count() == 0)
+	{
+		return false;
+	}
+	uint8_t code = request.get_code();
+	objective_entry *objective = objectives.find(code);
+	if(code != 0 && objective == NULL)
+	{
+		// declined by a session
+		return false;
+	}
+
+	uint8_t bits[MAXSTRINGLENGTH];
+	uint16_t len;
+	uint64_t version;
+	if(!sync_store.read(code, bits + Objective_Option::len_except_value, sizeof(bits) - Objective_Option::len_except_value, len, version))
+	{
+		return false;
+	}
+	uint8_t loop_count = request.get_loop_count();
+	if(objective != NULL && loop_count > objective->policy.max_loop_count)
+	{
+		loop_count = objective->policy.max_loop_count;
+	}
+	loop_count--;
+	Objective_Option::header_to_bits(bits, Synchronization, len, loop_count, request.get_flag(), code);
+
+	ERRNO rtnval = write_connection(r, conn, bits, Objective_Option::len_except_value + len, NEGO_END_MSG, session_id);
+	if(rtnval != SUCCESS)
+	{
+		std::cout<<"sync answer of version "<<version<<" failed:"<<rtnval<<std::endl;
+	}
+	return true;
+}
+
+/*************************************************************************
+*  Function name: asa_negotiate_encoded
+*  Description: pass a proposed value to the ASA and get the value it wants
+*  Parameter: value        proposed value, as received
+*  	          len          length of value
+*  	          answer       buffer for the wanted value
+*  	          answer_len   size of answer on input, length of the wanted value on output
+*  Return: ERRNO
+*  Remark: default for ASAs overriding asa_negotiate_result, whose values are C strings
+*  Modification record:
+*************************************************************************/
+ERRNO ServerMaster::asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len)
+{
+	c_string_value proposed(value, len);
+	const char * upper_data = (const char *)asa_negotiate_result(proposed.str);
+	if(upper_data == NULL)
+	{
+		return NULL_POINT_ERR;
+	}
+	size_t upper_len = strlen(upper_data);
+	if(upper_len > answer_len)
+	{
+		return OPTIONS_TOO_LONG_ERR;
+	}
+	memcpy(answer, upper_data, upper_len);
+	answer_len = upper_len;
+	return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: asa_negotiate_async
+*  Description: hand a proposed value to the ASA, which completes it when it has the value it wants
+*  Parameter: done   the value, where the answer goes and how to complete
+*  Return: void
+*  Remark: default for ASAs answering on the session's worker with asa_negotiate_encoded; an ASA
+*          overriding it may keep any number of values and complete them from its own threads,
+*          PROCESSING_TIMEOUT_MS without an answer sends WAIT_MSG meanwhile. Every value must be
+*          completed, the destructor of ServerMaster waits for them
+*  Modification record:
+*************************************************************************/
+void ServerMaster::asa_negotiate_async(AsaCompletion * done)
+{
+	uint16_t answer_len = done->answer_capacity();
+	ERRNO rtnval = asa_negotiate_encoded(done->value(), done->len(), done->answer(), answer_len);
+	done->complete(rtnval, rtnval == SUCCESS ? answer_len : 0);
+}
+
+/*************************************************************************
+*  Function name: find_result_cache
+*  Description: the answers cached for an objective
+*  Parameter: code   0 for the hooks of ServerMaster
+*  Return: ResultCache*   NULL if no objective is registered with code
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ResultCache* ServerMaster::find_result_cache(uint8_t code)
+{
+	if(code == 0)
+	{
+		return &result_cache;
+	}
+	objective_entry *objective = objectives.find(code);
+	return objective != NULL ? &objective->cache : NULL;
+}
+
+/*************************************************************************
+*  Function name: invalidate_results
+*  Description: forget the answers cached for an objective
+*  Parameter: code   0 for the hooks of ServerMaster
+*  Return: ERRNO   OBJECTIVE_UNKNOWN_ERR if no objective is registered with code
+*  Remark: called by the ASA when its state changes, from any thread
+*  Modification record:
+*************************************************************************/
+ERRNO ServerMaster::invalidate_results(uint8_t code)
+{
+	ResultCache *cache = find_result_cache(code);
+	if(cache == NULL)
+	{
+		return OBJECTIVE_UNKNOWN_ERR;
+	}
+	cache->invalidate();
+	return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: get_result_cache_stats
+*  Description: hits and misses of the answers cached for an objective
+*  Parameter: code   0 for the hooks of ServerMaster
+*  Return: result_cache_stats   zero if no objective is registered with code
+*  Remark:
+*  Modification record:
+*************************************************************************/
+result_cache_stats ServerMaster::get_result_cache_stats(uint8_t code)
+{
+	ResultCache *cache = find_result_cache(code);
+	if(cache == NULL)
+	{
+		result_cache_stats none = {0, 0};
+		return none;
+	}
+	return cache->get_stats();
+}
+
+/*************************************************************************
+*  Function name: asa_geq_encoded
+*  Description: ask the ASA whether two values are equal
+*  Parameter: value_a, len_a
+*  	          value_b, len_b
+*  Return: bool
+*  Remark: default for ASAs overriding asa_geq_fn, whose values are C strings; the values are
+*          copied and terminated, an answer written to a buffer is not
+*  Modification record:
+*************************************************************************/
+bool ServerMaster::asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b)
+{
+	c_string_value a(value_a, len_a);
+	c_string_value b(value_b, len_b);
+	return asa_geq_fn(a.str, b.str);
+}
+
 /*************************************************************************
 *  Function name: clear_when_session_end
 *  Description: clean up after session finished
-*  Parameter: usid  UniqueSession id
+*  Parameter: r     reactor the session belongs to
+*  	          usid  UniqueSession id
+*  	          tcp_sock  connection of the session
 *  Return: void
-*  Remark:
+*  Remark: the connection is closed here if the peer closed it already and this was its last session
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
-void ServerMaster::clear_when_session_end(uint32_t sessionId , int tcp_sock)
+void ServerMaster::clear_when_session_end(reactor* r, uint32_t sessionId , int tcp_sock)
 {
     //std::cout<<"clean up after session finished"<<std::endl;
-    std::map<uint32_t,ServerSession*>::iterator ss_iter;
     /*std::cout<<"Before cleaning:"<<std::endl;
     ss_iter = ss_map.begin();
     while(ss_iter != ss_map.end()){
@@ -431,33 +1330,31 @@ void ServerMaster::clear_when_session_end(uint32_t sessionId , int tcp_sock)
     }*/
 
     // clear ServerSession instance
-	ss_iter = ss_map.begin();
-    while(ss_iter != ss_map.end()){
-        if(ss_iter->first == sessionId){
-            //std::cout<<"cleaning ServerSession....."<<std::endl;
-            ServerSession* ss = ss_iter->second;
-            // call destructor of ServerSession
-            delete ss;
-            ss = NULL;
-
-            ss_map.erase(ss_iter);
+    ServerSession* ss = r->sessions.remove(sessionId, tcp_sock);
+    if(ss != NULL)
+    {
+        // the id can be handed out again
+        if(ss->get_owns_session_id())
+        {
+            UniqueSessionId::release(sessionId);
         }
-        ss_iter++;
+        // drop the reference of the table, the session is deleted once its
+        // steps and timers are done and the reactor can no longer be using it
+        ss->release();
     }
 
-    for(int i = 0 ;i < tcp_accepted ;i++)
+    pthread_mutex_lock(&r->conn_lock);
+    if(tcp_sock >= 0 && (size_t)tcp_sock < r->connections.size() && r->connections[tcp_sock] != NULL)
     {
-    	if(tcp_fd_set[i] == tcp_sock)
-    	{
-    		int j =i;
-    		while( j < tcp_accepted-1)
-    		{
-    			tcp_fd_set[j] = tcp_fd_set[j+1];
-    			j++;
-    		}
-    	}
-    	tcp_accepted--;
+        connection *conn = r->connections[tcp_sock];
+        conn->sessions--;
+        if(conn->closing && conn->sessions == 0)
+        {
+            free_connection(r, conn);
+        }
     }
+    pthread_mutex_unlock(&r->conn_lock);
+
      /*std::cout<<"After cleaning:"<<std::endl;
     ss_iter = ss_map.begin();
     while(ss_iter != ss_map.end()){
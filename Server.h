@@ -28,6 +28,15 @@
 //#include "BaseNegotiator.h"
 //#include "UniqueSessionId.h"
 #include "ServerSession.h"
+#include "SessionTable.h"
+#include "DiscoveryCache.h"
+#include "DiscoveryLimiter.h"
+#include "ObjectiveRegistry.h"
+#include "ObjectiveStore.h"
+#include "InterfaceMonitor.h"
+#include "ThreadPool.h"
+#include "TimerWheel.h"
+#include "ObjectiveCodec.h"
 //#include "common_structs.h"
 #include <map>
 #include <queue>
@@ -36,20 +45,74 @@
 #include <pthread.h>
 #include <ifaddrs.h>
 
-#define MAX_CLIENTS_NUM 5
+// most events taken from epoll_wait() per wakeup
+#define REACTOR_EVENTS 64
+// most octets queued on a connection whose peer does not read, a PDU past it fails with SEND_ERR
+#define CONNECTION_OUT_MAX (16 * (size_t)PDU_READER_SIZE)
 
 class Manager;
 
+// niceness of the thread answering discovery, it runs behind the reactors when they are busy
+#define DISCOVERY_NICE 10
+
+// one thread of the server negotiating, with its own listener bound with SO_REUSEPORT,
+// its own connections and its own sessions; see ServerMaster::run.
+// Discovery is answered on a thread of its own, see ServerMaster::run_discovery
+typedef struct reactor{
+    ServerMaster* sm;
+    int index;
+    pthread_t tid;
+    int epoll_fd;
+    int listen_sock;
+    // accepted connections indexed by socket, NULL where the socket is not one
+    std::vector<connection*> connections;
+    pthread_mutex_t conn_lock;
+    // sessions started from the connections of this reactor, looked up without a lock
+    SessionTable sessions;
+    // timers of those sessions, the reactor sleeps until the next one is due
+    TimerWheel timers;
+    // eventfd waking the reactor when a timer is armed to expire before it would wake
+    int wake_fd;
+    // eventfd making run() return, and whether the thread runs and is to be joined
+    int stop_fd;
+    bool running;
+}reactor;
+
+// microseconds from the construction of a ServerMaster to each step of its start, 0 until the step is done
+typedef struct startup_timing{
+    // local addresses read and the discovery responses encoded for them
+    uint64_t addresses_us;
+    // udp socket and the sockets of every reactor bound
+    uint64_t sockets_us;
+    // reactor threads running
+    uint64_t reactors_us;
+    // first discovery answered
+    uint64_t first_discovery_us;
+}startup_timing;
+
 class ServerMaster:public BaseNegotiator{
 public:
-    // constructor
-    ServerMaster();
+    // constructor, 0 for one reactor and one session worker per online core
+    ServerMaster(int reactor_count = 0, int worker_count = 0);
     // destructor
     virtual ~ ServerMaster();
 
     ERRNO server_init();
-    ERRNO listen_negotiate();
+    ERRNO listen_negotiate(int backlog = SOMAXCONN);
     ERRNO stop_negotiate();
+    // stop answering, wait for the values still with the ASA and drain the sessions; the hooks
+    // are virtual, so a class overriding them calls it in its destructor, while it is whole.
+    // Once or more, from a thread of the application, not from a hook
+    void stop();
+    // how long the start took so far, and the same printed
+    startup_timing get_startup_timing();
+    void print_startup_timing();
+    // divert discoveries to another server, NULL to answer them with a locator of this one
+    void set_divert(const char *locator){discovery_cache.set_divert(locator);}
+    // limit the discoveries answered, in total and per source; the rest are dropped and counted
+    void set_discovery_limits(const discovery_limits &limits){discovery_limiter.set_limits(limits);}
+    discovery_limits get_discovery_limits(){return discovery_limiter.get_limits();}
+    discovery_stats get_discovery_stats(){return discovery_limiter.get_stats();}
 
 /*************************************************************************
 *  Function name : ServerMaster::asa_geq_fn
@@ -80,24 +143,162 @@ public:
 		return value;
 	}
 
+    // the hooks ServerSession calls, working on encoded values and their lengths;
+    // by default they pass the values to the two hooks above as C strings
+    virtual ERRNO asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len);
+    virtual bool asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b);
+    // hand a value to the ASA without waiting for it: the ASA answers through done->complete(), from
+    // any thread, and the session goes on then; by default asa_negotiate_encoded() answers at once.
+    // Every value handed over must be completed: stop() waits for them, so an ASA completes or
+    // fails what it still has while stop() runs, and never waits on stop() itself
+    virtual void asa_negotiate_async(AsaCompletion * done);
+
+    // send a PDU on an accepted connection without blocking: what the socket does not take is queued
+    // and written by the reactor once the socket is writable; PDUs go out whole and in order
+    ERRNO write_connection(reactor* r, connection* conn, const void* data, size_t data_size, enum MSG_TYPE type, uint32_t session_id);
+
     //  clean up after session finished
-    void clear_when_session_end(uint32_t sessionId, int tcp_sock);
+    void clear_when_session_end(reactor* r, uint32_t sessionId, int tcp_sock);
+    // workers running the sessions
+    ThreadPool& get_pool(){return pool;}
+
+    // serve the objective with code (1 to 255, the high octet of the type of its Objective_Option)
+    // with handler instead of the hooks above, within policy, NULL for the defaults
+    ERRNO register_objective(uint8_t code, const char *name, ObjectiveHandler *handler, const objective_policy *policy = NULL)
+    {
+        return objectives.add(code, name, handler, policy);
+    }
+    ObjectiveRegistry& get_objectives(){return objectives;}
+
+    // keep up to entries answers of the hooks above for ttl_ms each (0 until invalidated), so a value
+    // proposed again is answered without them; call before server_init(), the objectives of
+    // register_objective() are cached by their policy
+    void cache_results(unsigned int entries, unsigned int ttl_ms){result_cache.configure(entries, ttl_ms);}
+    // forget the answers cached for the objective with code, when the state of its ASA changed
+    ERRNO invalidate_results(uint8_t code = 0);
+    result_cache_stats get_result_cache_stats(uint8_t code = 0);
+    // answers of the objective with code, NULL if it is not registered
+    ResultCache* find_result_cache(uint8_t code);
+
+    // publish the state of the objective with code, encoded; a synchronization request for it is
+    // answered with the state by the reactor, without a session or the ASA, until it is withdrawn
+    ERRNO publish_objective(uint8_t code, const uint8_t *value, uint16_t len){return sync_store.publish(code, value, len);}
+    void withdraw_objective(uint8_t code){sync_store.withdraw(code);}
+    ObjectiveStore& get_objective_store(){return sync_store;}
 private:
-    pthread_mutex_t fdset_lock;
-    int listen_sock;
-	fd_set read_flags;
-    std::map<uint32_t, ServerSession*> ss_map;
-    // value of the local network adapter
-    std::vector<std::string> local_interfaces;
-    int tcp_fd_set[MAX_CLIENTS_NUM];
-    int tcp_accepted;
+    int reactor_count;
+    int worker_count;
+    ThreadPool pool;
+    std::vector<reactor*> reactors;
+    // responses to discovery, by the interface a discovery comes in on
+    DiscoveryCache discovery_cache;
+    // handlers of the objectives other than code 0
+    ObjectiveRegistry objectives;
+    // answers of the hooks, code 0
+    ResultCache result_cache;
+    // states the ASA published, read by the reactors
+    ObjectiveStore sync_store;
+    DiscoveryLimiter discovery_limiter;
+    // the udp socket discovery comes in on, and the thread answering it
+    int discovery_sock;
+    // eventfd stopping that thread
+    int discovery_stop_fd;
+    pthread_t discovery_tid;
+    bool discovery_running;
+    // addresses of this node, followed through rtnetlink
+    InterfaceMonitor interfaces;
+    // CLOCK_MONOTONIC at the construction, in microseconds
+    uint64_t constructed_us;
+    startup_timing timing;
 
     bool check_Addr(struct sockaddr_in6 client_Addr);
+    ERRNO watch_fd(reactor* r, int fd);
+    void accept_connections(reactor* r);
+    connection* find_connection(reactor* r, int fd);
+    void drop_connection(reactor* r, connection* conn);
+    void free_connection(reactor* r, connection* conn);
+    // write what a connection has queued, and stop waiting for it to be writable once nothing is left
+    void flush_connection(reactor* r, connection* conn);
+    // whether the reactor waits for a connection to be writable, conn->write_lock held
+    void watch_writable(reactor* r, connection* conn, bool writable);
+    // distribute the PDUs an accepted connection has ready
+    void read_connection(reactor* r, int tcp_sock);
+    // answer the discovery messages waiting on the udp socket, a batch at a time
+    bool answer_discovery();
+    void run_discovery();
+    static void* run_discovery_help(void *arg);
+    void stop_discovery();
+    // make every reactor return from run() and join it
+    void stop_reactors();
+    // answer a synchronization request from sync_store, false to leave it to a session
+    bool answer_sync(reactor* r,connection* conn,uint32_t session_id,const void* buffer,size_t buffer_size);
     // distribute data to specific thread
-    void distribute(uint32_t session_id,const void* buffer,size_t buffer_size,enum MSG_TYPE type);
-     void run();
+    void distribute(reactor* r,connection* conn,uint32_t session_id,const void* buffer,size_t buffer_size,enum MSG_TYPE type);
+     void run(reactor* r);
      static void* run_help(void *arg);
+     // waker of the timer wheel of a reactor
+     static void wake_reactor(void *arg);
+     // the addresses of this node changed
+     static void interfaces_changed(void *arg);
+     // record that a step of the start is done, the first time only
+     void mark_startup(uint64_t *step);
+
+};
 
+// ServerMaster for an objective whose values are of type T, see objective_codec; the class
+// implementing asa_geq and asa_negotiate calls stop() in its destructor, they are pure here
+template<typename T>
+class Typed_ServerMaster:public ServerMaster{
+public:
+/*************************************************************************
+*  Function name : Typed_ServerMaster::asa_geq
+*  Description : provided by the ASA for comparing whether the value is equal, should be overwritten
+*  Parameter:	const T & value_a
+*  						const T & value_b
+*  Return:bool
+*  Remark:pure virtual function
+*  Modification record:
+*************************************************************************/
+	virtual bool asa_geq(const T & value_a, const T & value_b) = 0;
+
+/*************************************************************************
+*  Function name : Typed_ServerMaster::asa_negotiate
+*  Description : provided by the ASA for GDNP to pass the negotiated value to ASA and return the value for negotiation, should be overwritten
+*  Parameter:	const T & value
+*  Return:T    the value ASA want
+*  Remark:pure virtual function
+*  Modification record:
+*************************************************************************/
+	virtual T asa_negotiate(const T & value) = 0;
+
+	virtual ERRNO asa_negotiate_encoded(const uint8_t * value, uint16_t len, uint8_t * answer, uint16_t &answer_len)
+	{
+		T proposed;
+		if(!objective_codec<T>::decode(value, len, proposed))
+			return OPTION_LEN_ERR;
+		T wanted = asa_negotiate(proposed);
+		if(!objective_codec<T>::encode(wanted, answer, answer_len, answer_len))
+			return OPTIONS_TOO_LONG_ERR;
+		return SUCCESS;
+	}
+
+	virtual bool asa_geq_encoded(const uint8_t * value_a, uint16_t len_a, const uint8_t * value_b, uint16_t len_b)
+	{
+		T a, b;
+		if(!objective_codec<T>::decode(value_a, len_a, a) || !objective_codec<T>::decode(value_b, len_b, b))
+			return false;
+		return asa_geq(a, b);
+	}
+
+	// publish value as the state of the objective with code, see ServerMaster::publish_objective
+	ERRNO publish(const T & value, uint8_t code = 0)
+	{
+		uint8_t bits[OBJECTIVE_STORE_VALUE_MAX];
+		uint16_t len;
+		if(!objective_codec<T>::encode(value, bits, sizeof(bits), len))
+			return OPTIONS_TOO_LONG_ERR;
+		return publish_objective(code, bits, len);
+	}
 };
 
 #endif /* defined(ServerMaster__) */
@@ -24,66 +24,12 @@
 
 #include "ServerSession.h"
 #include "Errno.h"
-#include <unistd.h>
-//#include "UniqueSessionId.h"
+#include "UniqueSessionId.h"
 #include "Server.h"
 #include "Option.h"
 #include <pthread.h>
 #include <string.h>
 
-/*************************************************************************
-*  Function name: queue_push
-*  Description: push new message content into queue
-*  Parameter: c  content
-*  Return: void
-*  Remark:
-*  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
-*************************************************************************/
-void ServerSession::queue_push(content c)
-{
-    // lock
-    pthread_mutex_lock(&queuelock);
-    this->q->push(c);
-    // unlock
-    pthread_mutex_unlock(&queuelock);
-}
-
-/*************************************************************************
-*  Function name: queue_pop
-*  Description: pop from queue
-*  Parameter:
-*  Return: void
-*  Remark:
-*  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
-*************************************************************************/
-content ServerSession::queue_pop()
-{
-    pthread_mutex_lock(&queuelock);
-    content c = q->front();
-    q->pop();
-    pthread_mutex_unlock(&queuelock);
-    return c;
-}
-
-/*************************************************************************
-*  Function name: queue_empty
-*  Description: determine whether queue is empty
-*  Parameter: none
-*  Return: bool
-*  Remark:
-*  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
-*************************************************************************/
-bool ServerSession::queue_empty()
-{
-    pthread_mutex_lock(&queuelock);
-    bool result = q->empty();
-    pthread_mutex_unlock(&queuelock);
-    return result;
-}
-
 /*************************************************************************
 *  Function name: get_cur_state
 *  Description: get session state
@@ -121,26 +67,47 @@ void ServerSession::set_cur_state(enum server_states state)
 /*************************************************************************
 *  Function name: ServerSession
 *  Description: constructor of ServerSession
-*  Parameter: clientAddr   session state to set
+*  Parameter: sm           ServerMaster running the session
+*  	          r            reactor the session belongs to
 *  	          nsocket      socket id
 *  	          session_id
 *  	          c            content
+*  	          owns_session_id   session_id was reserved in UniqueSessionId for this session
 *  Return: none
-*  Remark:
+*  Remark: nothing runs before start()
 *  Lastly modified by Cheng Pang on 15-5-27
 *************************************************************************/
-ServerSession::ServerSession(int tcp_sock,uint32_t session_id,content c)
+ServerSession::ServerSession(ServerMaster* sm, struct reactor* r, connection* conn,uint32_t session_id,content c,bool owns_session_id)
 //:BaseNegotiator(nsocket)
 {
+	this->owns_session_id = owns_session_id;
 	pthread_mutex_init(&statelock,NULL);
-	pthread_mutex_init(&queuelock,NULL);
-	this->tcp_sock = tcp_sock;
+	this->tcp_sock = conn->fd;
+	this->conn = conn;
     this->session_id = session_id;
     this->cur_state = IDLE;
-    idle_check = 0;
-    // push into queue
-    this->q = new std::queue<content>();
-    this->queue_push(c);
+    this->sm = sm;
+    this->r = r;
+    refs = 1;
+    scheduled = 0;
+    activity = 0;
+    ended = false;
+    asa.session = this;
+    asa.objective = NULL;
+    asa_answered = 0;
+    processing_ms = PROCESSING_TIMEOUT_MS;
+    timer_node_init(&wait_node);
+    wait_activity = 0;
+    timer_node_init(&end_node);
+    end_activity = 0;
+    timed_out = false;
+    expired_activity = 0;
+    wait_due = false;
+    // the mailbox is empty, the first message always fits
+    mailbox.push(c);
+    // runs to its wait for the first message, the first step resumes it
+    negotiation = negotiate();
+    negotiation.start();
 
 }
 
@@ -155,224 +122,597 @@ ServerSession::ServerSession(int tcp_sock,uint32_t session_id,content c)
 *  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
 ServerSession::~ServerSession(){
-    pthread_mutex_lock(&queuelock);
-    while (q != NULL && !q->empty())
+    pthread_mutex_destroy(&statelock);
+    //std::cout<<"running SS's destruct function"<<std::endl;
+}
+
+/*************************************************************************
+*  Function name: acquire
+*  Description: take a reference to the session
+*  Parameter: none
+*  Return: bool   false if the last reference is gone and the session is being deleted
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool ServerSession::acquire()
+{
+    int n = __atomic_load_n(&refs, __ATOMIC_SEQ_CST);
+    while(n > 0)
     {
-        q->pop();
+        if(__atomic_compare_exchange_n(&refs, &n, n + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            return true;
+        }
     }
-    if(q != NULL)
+    return false;
+}
+
+/*************************************************************************
+*  Function name: release
+*  Description: give a reference back
+*  Parameter: none
+*  Return: void
+*  Remark: the last one retires the session, the caller must not use it afterwards
+*  Modification record:
+*************************************************************************/
+void ServerSession::release()
+{
+    if(__atomic_sub_fetch(&refs, 1, __ATOMIC_SEQ_CST) == 0)
     {
-        delete q;
-        q = NULL;
+        r->sessions.retire(this);
     }
-    pthread_mutex_unlock(&queuelock);
-    //std::cout<<"running SS's destruct function"<<std::endl;
 }
 
 /*************************************************************************
-*  Function name: run_help
-*  Description: static run function
-*  Parameter: arg   point to session_run_parms
-*  Return: void*
-*  Remark:
+*  Function name: start
+*  Description: queue the step handling the first message
+*  Parameter: none
+*  Return: void
+*  Remark: call once the session is in the session table
 *  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
-void* ServerSession::run_help(void *arg){
-    session_run_parms* parm_p = (session_run_parms*)arg;
-    parm_p->ss->run(parm_p->sm);
-    return  (void*)0;
+void ServerSession::start()
+{
+    schedule();
 }
 
 /*************************************************************************
-*  Function name: run
-*  Description:  handle session for each thread
-*  Parameter: sm  point to ServerMaster
+*  Function name: abandon
+*  Description: let go of a session the server stops before it ends
+*  Parameter: none
 *  Return: void
-*  Remark:
+*  Remark: called by ServerMaster at shutdown, with the session taken out of its table, no step
+*          left and the wheel no longer turning; the session is retired with the last reference
 *  Modification record:
-*  Lastly modified by Cheng Pang on 15-5-27
 *************************************************************************/
-void ServerSession::run(ServerMaster* sm){
-    content last_content;
-    while (get_cur_state() != SESSION_END)
+void ServerSession::abandon()
+{
+    cancel_timer(&wait_node);
+    cancel_timer(&end_node);
+    if(!__atomic_exchange_n(&ended, true, __ATOMIC_SEQ_CST) && owns_session_id)
     {
-        if(this->queue_empty()){
-            sleep(1);
-            continue;
-        }
-        idle_check = 1;
-        // pop from queue, get its first element
-        content c = this->queue_pop();
-        //std::cout<<pthread_self()<<"receive package :data="<<c.data<<", type="<<c.type<<"and cur_state="<<cur_state<<std::endl;
+        UniqueSessionId::release(session_id);
+    }
+    // the reference of the table
+    release();
+}
 
-		// filtering out duplicate REQUEST
-        if(c == last_content)
-        {
-            //std::cout<<pthread_self()<<"duplicate REQUEST package"<<std::endl;
-            continue;
-        }
-        else{
-            last_content = c;
-        }
+/*************************************************************************
+*  Function name: deliver
+*  Description: queue a message and make sure a step handles it
+*  Parameter: c  content
+*  Return: bool   false if the mailbox is full and the message was dropped
+*  Remark: called by the reactor while it holds the session table read lock
+*  Modification record:
+*************************************************************************/
+bool ServerSession::deliver(const content &c)
+{
+    if(!mailbox.push(c))
+    {
+        return false;
+    }
+    schedule();
+    return true;
+}
+
+/*************************************************************************
+*  Function name: schedule
+*  Description: queue a step unless one is queued or running already
+*  Parameter: none
+*  Return: void
+*  Remark: the step holds a reference until it returns
+*  Modification record:
+*************************************************************************/
+void ServerSession::schedule()
+{
+    int expected = 0;
+    if(!__atomic_compare_exchange_n(&scheduled, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        // the step queued or running sees the message
+        return;
+    }
+    if(!acquire())
+    {
+        return;
+    }
+    sm->get_pool().submit(step_task, this);
+}
 
-        //update state
-        int rtnval = set_state(c.type);
-        if(rtnval == SUCCESS)
+/*************************************************************************
+*  Function name: step_task
+*  Description: static function running a step on a worker
+*  Parameter: arg   point to ServerSession
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ServerSession::step_task(void* arg)
+{
+    ServerSession* ss = (ServerSession*)arg;
+    ss->step();
+    ss->release();
+}
+
+/*************************************************************************
+*  Function name: step
+*  Description: resume the negotiation with the messages queued, with its time-out or with
+*               the answer of the ASA, and end the session once it has returned
+*  Parameter: none
+*  Return: void
+*  Remark: only one step runs at a time, a message or time-out arriving while it finishes
+*          is either seen by it or schedules the next one
+*  Modification record:
+*************************************************************************/
+void ServerSession::step()
+{
+    for(;;)
+    {
+        content c;
+        while(!negotiation.done())
         {
-			if(get_cur_state() == PROCESSING)
-			{
-                //std::cout<<pthread_self()<<"launch a thread to send wait msg ...cur_state="<<cur_state<<std::endl;
-                pthread_t tid;
-                pthread_create(&tid, NULL, wait_thread_handler, this);
-            }
-			Objective_Option recv_option = Objective_Option::parse_bits((uint16_t *)c.data);
-			std::cout << "thread " <<pthread_self() << std::endl << "msg type "<< c.type << std::endl
-						<< "option type " << recv_option.get_type() << std::endl
-						<< "value " << (char*)recv_option.get_value() << std::endl
-						<< "len " << recv_option.get_len() << std::endl
-						<< "loop_count " << (int)recv_option.get_loop_count() << std::endl << std::endl;;
-            if(get_cur_state() != SESSION_END)
+            if(negotiation.waiting_completion())
             {
-            	if(c.type != NEGO_MSG && c.type != REQUEST_MSG)
-            	{
-//            		*option = Option::parse_bits((uint16_t *)c.data, strlen(c.data));
-					dieWithUserMessager("It' should be a objective option");
-					std::cout << "msg type "<< c.type  << std::endl;
-					continue;
-				}
-            	recv_option.set_loop_count(recv_option.get_loop_count() - 1);
-            	//upper PROCESSING
-            	char *upper_data =  (char *)sm->asa_negotiate_result(recv_option.get_value());
-            	//upper PROCESSING end
-            	 set_cur_state(IDLE);
-                // call upper
-                // upper action
-                enum MSG_TYPE type;
-                if(recv_option.get_type() == Synchronization)//Synchronization
-				{
-                	type = NEGO_END_MSG;
-                	uint16_t value_len = strlen(upper_data);
-                	Objective_Option send_option(recv_option.get_type(), value_len, (uint8_t*)upper_data, recv_option.get_loop_count() , recv_option.get_flag());
-					std::cout << "Recived a request with Synchronization Option ! " << std::endl;
-					if((rtnval = send(send_option.to_bits(), send_option.get_len()  + Objective_Option::len_except_value, type)) != SUCCESS)
-					{
-						std::cout<<pthread_self()<<"send  failed:"<<rtnval<<std::endl;
-					}
-					set_cur_state(SESSION_END);
-				}
-                else if ( !sm->asa_geq_fn (upper_data, recv_option.get_value()) && (recv_option.get_loop_count() != 0))//not same objective and loop_count != 0
+                // messages stay in the mailbox until the ASA answers
+                if(!__atomic_exchange_n(&asa_answered, 0, __ATOMIC_SEQ_CST))
                 {
-                	uint16_t value_len = strlen(upper_data);
-                	Objective_Option send_option(recv_option.get_type(), value_len, (uint8_t*)upper_data, recv_option.get_loop_count() , recv_option.get_flag());
-                	type = NEGO_MSG;
-                    if((rtnval = send(send_option.to_bits(), send_option.get_len() + Objective_Option::len_except_value, type)) != SUCCESS)
-                    {
-						std::cout<<pthread_self()<<" send  failed:"<<rtnval<<std::endl;
-					}
-                }
-                else //same objective or loop_count == 0
-                {
-
-                    type = NEGO_END_MSG;
-                    Option *send_option;
-                    if(recv_option.get_loop_count() == 0)
-                    {
-						send_option = new Option(Decline, 0, NULL);
-						std::cout << "Over loop_count ,decline!" << std::endl;
-                    }
-                    else
-                    {
-                    	send_option = new Option(Accept, 0, NULL);
-                    	std::cout << "Accept!!" << std::endl;
-                    }
-					if((rtnval = send(send_option->to_bits(), send_option->get_len()  + Option::len_except_value, type)) != SUCCESS)
-					{
-						std::cout<<pthread_self()<<"send  failed:"<<rtnval<<std::endl;
-					}
-
-					set_cur_state(SESSION_END);
+                    break;
                 }
+                negotiation.resume_completion();
+            }
+            else if(mailbox.pop(c))
+            {
+                __atomic_add_fetch(&activity, 1, __ATOMIC_SEQ_CST);
+                // the peer spoke, it is not idle
+                cancel_timer(&end_node);
+                negotiation.resume(c);
             }
             else
             {
-            	Option recv_option = Option::parse_bits((uint16_t *)c.data);
-            	if(recv_option.get_type() == Accept)
-					std::cout << "The negotiation is accepted" << std::endl;
-				else if (recv_option.get_type() == Decline)
-					std::cout << "The negotiation is declined" << std::endl;
+                break;
+            }
+            if(!negotiation.done() && negotiation.wait_ms() != 0)
+            {
+                arm_timer(&end_node, end_activity, negotiation.wait_ms(), end_timer);
+            }
+        }
+        // WAIT_MSG goes out from the step, never between the messages the negotiation sends
+        if(__atomic_exchange_n(&wait_due, false, __ATOMIC_SEQ_CST) && !negotiation.done() && negotiation.waiting_completion()
+           && !__atomic_load_n(&asa_answered, __ATOMIC_SEQ_CST)
+           && __atomic_load_n(&activity, __ATOMIC_SEQ_CST) == __atomic_load_n(&wait_activity, __ATOMIC_SEQ_CST))
+        {
+            send_wait();
+        }
+        if(!negotiation.done() && !negotiation.waiting_completion() && __atomic_exchange_n(&timed_out, false, __ATOMIC_SEQ_CST)
+           && __atomic_load_n(&expired_activity, __ATOMIC_SEQ_CST) == __atomic_load_n(&activity, __ATOMIC_SEQ_CST))
+        {
+            negotiation.time_out();
+        }
+        if(negotiation.done())
+        {
+            set_cur_state(SESSION_END);
+            // their references would keep the session until they fire
+            cancel_timer(&wait_node);
+            cancel_timer(&end_node);
+            if(!__atomic_exchange_n(&ended, true, __ATOMIC_SEQ_CST))
+            {
+                // the connection stays open for other sessions, ServerMaster closes it when the peer does
+                // clean up session id for ServerMaster
+                std::cout<<"Negotiation end！"<<std::endl;
+                sm->clear_when_session_end(r, session_id, tcp_sock);
             }
+            // scheduled stays set, no step runs after the end
+            return;
+        }
+        __atomic_store_n(&scheduled, 0, __ATOMIC_SEQ_CST);
+        if(mailbox.empty() && !__atomic_load_n(&timed_out, __ATOMIC_SEQ_CST) && !__atomic_load_n(&asa_answered, __ATOMIC_SEQ_CST)
+           && !__atomic_load_n(&wait_due, __ATOMIC_SEQ_CST))
+        {
+            return;
+        }
+        int expected = 0;
+        if(!__atomic_compare_exchange_n(&scheduled, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            // a step was queued for it already
+            return;
         }
     }
-    close_tcp();
-    // clean up session id for ServerMaster
-    std::cout<<"Negotiation end！"<<std::endl;
-    sm->clear_when_session_end(session_id, tcp_sock);
 }
 
 /*************************************************************************
-*  Function name: wait_thread_handler
-*  Description:  didn't get response from upper in PROCESSING_TIMEOUT_SECOND,send WAIT message
-*  Parameter: arg    point to ServerSession
-*  Return: void*
-*  Remark:
+*  Function name: negotiate
+*  Description: the negotiation of the session: a REQUEST_MSG or NEGO_MSG is handed to the ASA
+*               and answered with a NEGO_MSG, which waits END_TIMEOUT_MS for the next one, or
+*               with a NEGO_END_MSG ending it; a NEGO_END_MSG of the peer ends it too
+*  Parameter: none
+*  Return: NegotiationTask   suspended before its first wait
+*  Remark: a coroutine, step() resumes it with each message, with the time-out of its wait and
+*          once the ASA answered
 *  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
-void* ServerSession::wait_thread_handler(void* arg)
+NegotiationTask ServerSession::negotiate()
 {
-	ServerSession* ss = (ServerSession*)arg;
-	int total_sleep = 0;
-	while(ss->get_cur_state() == PROCESSING)
-	{
-		sleep(1);
-		total_sleep++;
-		if(ss->get_cur_state() != PROCESSING)
+    // the REQUEST_MSG starting the session is in the mailbox already
+    unsigned int wait_ms = 0;
+    for(;;)
+    {
+        const pdu_event &e = co_await NegotiationTask::next_pdu(wait_ms);
+        if(e.timed_out)
+        {
+            //std::cout<<pthread_self()<<":no new package, time-out! "<<std::endl;
+            co_return TIMEOUT;
+        }
+        const content &c = *e.pdu;
+
+		// filtering out retransmits of the recent messages; every message the peer means
+		// differs from the ones before, its objective carries a loop count going down
+        if(!recent.add(c.type, c.data, c.data_len))
+        {
+            //std::cout<<pthread_self()<<"duplicate REQUEST package"<<std::endl;
+            continue;
+        }
+
+        // decode the option in place, malformed messages are dropped
+        OptionView recv_option;
+        if(recv_option.parse(c.data, c.data_len) != SUCCESS)
+        {
+            dieWithUserMessager("receive a malformed option");
+            continue;
+        }
+
+        if(c.type == NEGO_END_MSG)
+        {
+        	if(recv_option.get_type() == Accept)
+				std::cout << "The negotiation is accepted" << std::endl;
+			else if (recv_option.get_type() == Decline)
+				std::cout << "The negotiation is declined" << std::endl;
+            co_return SUCCESS;
+        }
+        if(c.type != NEGO_MSG && c.type != REQUEST_MSG)
+        {
+            dieWithUserMessager("Server doesn't allowed recv this MSG in a negotiation");
+            continue;
+        }
+
+		std::cout << "thread " <<pthread_self() << std::endl << "msg type "<< c.type << std::endl
+					<< "option type " << recv_option.get_type() << std::endl
+					<< "value " << (char*)recv_option.get_value() << std::endl
+					<< "len " << recv_option.get_len() << std::endl
+					<< "loop_count " << (int)recv_option.get_loop_count() << std::endl << std::endl;;
+    	if(!recv_option.is_objective())
+    	{
+			dieWithUserMessager("It' should be a objective option");
+			std::cout << "msg type "<< c.type  << std::endl;
+			continue;
+		}
+    	// the handler of the objective, NULL for code 0, served by the hooks of ServerMaster
+    	uint8_t code = recv_option.get_code();
+    	objective_entry *objective = sm->get_objectives().find(code);
+    	// c is the step's and gone once the negotiation waits for the ASA, keep what is needed of it
+    	uint8_t loop_count = recv_option.get_loop_count();
+    	if(objective != NULL && loop_count > objective->policy.max_loop_count)
+    	{
+    		loop_count = objective->policy.max_loop_count;
+    	}
+    	loop_count--;
+    	enum option_type objective_type = recv_option.get_type();
+    	uint8_t flag = recv_option.get_flag();
+    	//upper PROCESSING, the ASA writes its answer right behind the option header
+    	uint8_t bits[MAXSTRINGLENGTH];
+    	uint8_t *upper_data = bits + Objective_Option::len_except_value;
+    	uint16_t upper_capacity = sizeof(bits) - Objective_Option::len_except_value;
+    	ERRNO asa_rtnval;
+    	uint16_t upper_len = 0;
+    	// whether the ASA takes its answer for the same as the proposal, for negotiation
+    	bool same = false;
+    	ResultCache *cache = objective != NULL ? &objective->cache : sm->find_result_cache(0);
+    	if(code != 0 && objective == NULL)
+    	{
+    		asa_rtnval = OBJECTIVE_UNKNOWN_ERR;
+    	}
+    	else if(cache->enabled()
+    	        && cache->lookup(objective_type, recv_option.get_value(), recv_option.get_len(), upper_data, upper_capacity, upper_len, same))
+    	{
+    		// proposed before and answered since the ASA state last changed
+    		asa_rtnval = SUCCESS;
+    	}
+    	else if(!ObjectiveRegistry::begin(objective))
+    	{
+    		asa_rtnval = OBJECTIVE_BUSY_ERR;
+    	}
+    	else
+    	{
+    		uint32_t ticket = cache->ticket();
+    		dispatch_asa(objective, recv_option.get_value(), recv_option.get_len(), upper_data, upper_capacity);
+    		co_await NegotiationTask::completion(&asa_answered);
+    		//upper PROCESSING end, the state is IDLE and the wait timer cancelled again
+    		asa_rtnval = asa.result;
+    		upper_len = asa.answered_len;
+    		if(asa_rtnval == SUCCESS)
+    		{
+    			if(objective_type != Synchronization)
+    			{
+    				same = objective != NULL ? objective->handler->geq_encoded(upper_data, upper_len, asa.value(), asa.len())
+    				                         : sm->asa_geq_encoded(upper_data, upper_len, asa.value(), asa.len());
+    			}
+    			if(cache->enabled())
+    			{
+    				cache->store(ticket, objective_type, asa.value(), asa.len(), upper_data, upper_len, same);
+    			}
+    		}
+    	}
+    	if(asa_rtnval != SUCCESS)
+    	{
+    		std::cout<<pthread_self()<<" ASA gave no answer:"<<asa_rtnval<<std::endl;
+    	}
+
+        ERRNO rtnval;
+        if(objective_type == Synchronization && asa_rtnval == SUCCESS)//Synchronization
 		{
-			//std::cout<<"wait_thread "<<pthread_self()<<":over! cur_state="<<ss->get_cur_state()<<std::endl;
-			break;
+        	Objective_Option::header_to_bits(bits, objective_type, upper_len, loop_count, flag, code);
+			std::cout << "Recived a request with Synchronization Option ! " << std::endl;
+			if((rtnval = send(bits, Objective_Option::len_except_value + upper_len, NEGO_END_MSG)) != SUCCESS)
+			{
+				std::cout<<pthread_self()<<"send  failed:"<<rtnval<<std::endl;
+			}
+			co_return rtnval;
 		}
-		else if(ss->get_cur_state() == PROCESSING && total_sleep >=  PROCESSING_TIMEOUT_SECOND){
-			//std::cout<<"wait_thread "<<pthread_self()<<":send WAIT MSG"<<std::endl;
-			uint32_t time = WAIT_TIMEOUT_SECOND * 1000;
-			Option wait_option(Waiting_time, 4, (uint8_t*)&time);
-            ss->send(wait_option.to_bits(), wait_option.get_len() + Option::len_except_value, WAIT_MSG);
-			total_sleep = 0;
-   	    }
+        if (asa_rtnval == SUCCESS && !same && (loop_count != 0))//not same objective and loop_count != 0
+        {
+        	Objective_Option::header_to_bits(bits, objective_type, upper_len, loop_count, flag, code);
+            if((rtnval = send(bits, Objective_Option::len_except_value + upper_len, NEGO_MSG)) != SUCCESS)
+            {
+				std::cout<<pthread_self()<<" send  failed:"<<rtnval<<std::endl;
+				co_return rtnval;
+			}
+            // end the session if the peer goes quiet
+            wait_ms = objective != NULL ? objective->policy.end_timeout_ms : END_TIMEOUT_MS;
+            continue;
+        }
+        //same objective or loop_count == 0
+        Option send_option(Accept, 0, NULL);
+        if(loop_count == 0 || asa_rtnval != SUCCESS)
+        {
+			send_option = Option(Decline, 0, NULL);
+			std::cout << "Over loop_count ,decline!" << std::endl;
+        }
+        else
+        {
+        	std::cout << "Accept!!" << std::endl;
+        }
+		uint16_t bits_size = send_option.to_bits(bits, sizeof(bits));
+		if((rtnval = send(bits, bits_size, NEGO_END_MSG)) != SUCCESS)
+		{
+			std::cout<<pthread_self()<<"send  failed:"<<rtnval<<std::endl;
+		}
+		co_return rtnval;
     }
-    return (void*)0;
 }
 
 /*************************************************************************
-*  Function name: end_thread_handler
-*  Description:  didn't receive new request in END_TIMEOUT_SECOND, update state into SESSION_END
-*  Parameter: arg    point to ServerSession
-*  Return: ERRNO
-*  Remark:
+*  Function name: arm_timer
+*  Description: arm a timer of the session on the wheel of its reactor
+*  Parameter: t                wait_node or end_node
+*  	          armed_activity   wait_activity or end_activity
+*  	          ms
+*  	          fn               wait_timer or end_timer
+*  Return: void
+*  Remark: the timer holds a reference until it fires or is cancelled, a timer armed already is left as it is
+*  Modification record:
+*************************************************************************/
+void ServerSession::arm_timer(timer_node *t, uint32_t &armed_activity, unsigned int ms, void (*fn)(void *))
+{
+    if(!acquire())
+    {
+        return;
+    }
+    __atomic_store_n(&armed_activity, __atomic_load_n(&activity, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    if(!r->timers.arm(t, ms, fn, this))
+    {
+        release();
+    }
+}
+
+/*************************************************************************
+*  Function name: cancel_timer
+*  Description: disarm a timer of the session
+*  Parameter: t   wait_node or end_node
+*  Return: void
+*  Remark: a timer firing already runs to its end and gives its reference back itself
+*  Modification record:
+*************************************************************************/
+void ServerSession::cancel_timer(timer_node *t)
+{
+    if(r->timers.cancel(t))
+    {
+        release();
+    }
+}
+
+/*************************************************************************
+*  Function name: dispatch_asa
+*  Description: hand a value of the peer to the ASA, with the session PROCESSING and the wait timer armed
+*  Parameter: objective  its handler, NULL for the hooks of ServerMaster
+*  	          value      the value proposed, copied
+*  	          len
+*  	          answer     where the ASA writes its answer
+*  	          capacity   octets answer holds
+*  Return: void
+*  Remark: the ASA holds a reference until it completes, and a hold on the pool so that ServerMaster
+*          waits for the completion before it stops. It is called from a task of its own, so the step
+*          returns and a step can send WAIT_MSG while an ASA answering at once blocks its worker
 *  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
-void* ServerSession::end_thread_handler(void* arg){
+void ServerSession::dispatch_asa(objective_entry *objective, const uint8_t *value, uint16_t len, uint8_t *answer, uint16_t capacity)
+{
+    set_cur_state(PROCESSING);
+    processing_ms = objective != NULL ? objective->policy.processing_timeout_ms : PROCESSING_TIMEOUT_MS;
+    //std::cout<<pthread_self()<<"arm the timer sending wait msg ...cur_state="<<cur_state<<std::endl;
+    arm_timer(&wait_node, wait_activity, processing_ms, wait_timer);
+    // the running step holds a reference, this one cannot fail
+    acquire();
+    if(len > MAXSTRINGLENGTH)
+    {
+        len = MAXSTRINGLENGTH;
+    }
+    memcpy(asa.proposed, value, len);
+    asa.proposed[len] = '\0';
+    asa.proposed_len = len;
+    asa.answer_buf = answer;
+    asa.capacity = capacity;
+    asa.result = ERROR;
+    asa.answered_len = 0;
+    asa.objective = objective;
+    sm->get_pool().hold();
+    sm->get_pool().submit(asa_task, this);
+}
+
+/*************************************************************************
+*  Function name: asa_task
+*  Description: static function handing the value of dispatch_asa() to the ASA on a worker
+*  Parameter: arg   point to ServerSession
+*  Return: void
+*  Remark: the reference dispatch_asa() took is released as the ASA completes
+*  Modification record:
+*************************************************************************/
+void ServerSession::asa_task(void* arg)
+{
     ServerSession* ss = (ServerSession*)arg;
-    int total_sleep = 0;
-    while (total_sleep < END_TIMEOUT_SECOND)
+    if(ss->asa.objective != NULL)
     {
-        sleep(1);
-        total_sleep++;
-        if(ss->idle_check == 1)
-        {
-        	ss->idle_check = 0;
-        	return 0;
-        }
+        ss->asa.objective->handler->negotiate_async(&ss->asa);
     }
+    else
+    {
+        ss->sm->asa_negotiate_async(&ss->asa);
+    }
+}
 
-    // have no new request
-//    if(ss->idle_check == 0)
+/*************************************************************************
+*  Function name: AsaCompletion::complete
+*  Description: the ASA answered, or gave up on the value
+*  Parameter: rtnval       SUCCESS with an answer
+*  	          answer_len   octets of the answer
+*  Return: void
+*  Remark: from any thread, once per value
+*  Modification record:
+*************************************************************************/
+void AsaCompletion::complete(ERRNO rtnval, uint16_t answer_len)
+{
+    result = rtnval;
+    answered_len = answer_len <= capacity ? answer_len : 0;
+    if(answered_len == 0 && answer_len != 0)
     {
-		//std::cout<<"end_thread "<<pthread_self()<<":no new package, time-out! "<<std::endl;
-        ss->set_cur_state(SESSION_END);
+        result = OPTIONS_TOO_LONG_ERR;
     }
-    return (void*)0;
+    session->asa_completed();
+}
+
+/*************************************************************************
+*  Function name: asa_completed
+*  Description: end the PROCESSING of a value and have a step resume the negotiation with the answer
+*  Parameter: none
+*  Return: void
+*  Remark: the wait timer is cancelled here, so no WAIT_MSG goes out once the ASA answered; the
+*          hold of dispatch_asa() is released once the step resuming the negotiation is queued
+*  Modification record:
+*************************************************************************/
+void ServerSession::asa_completed()
+{
+    ThreadPool &pool = sm->get_pool();
+    set_cur_state(IDLE);
+    cancel_timer(&wait_node);
+    ObjectiveRegistry::end(asa.objective);
+    __atomic_store_n(&asa_answered, 1, __ATOMIC_SEQ_CST);
+    schedule();
+    // the reference dispatch_asa() took for the ASA
+    release();
+    pool.unhold();
+}
+
+/*************************************************************************
+*  Function name: wait_timer
+*  Description: didn't get response from upper in processing_ms, have a step send WAIT message
+*  Parameter: arg    point to ServerSession
+*  Return: void
+*  Remark: runs on the reactor thread, the timer is armed as the value goes to the ASA and cancelled as it completes
+*  Modification record:
+*  Lastly modified by Cheng Pang on 15-4-29
+*************************************************************************/
+void ServerSession::wait_timer(void* arg)
+{
+	ServerSession* ss = (ServerSession*)arg;
+	if(__atomic_load_n(&ss->activity, __ATOMIC_SEQ_CST) == __atomic_load_n(&ss->wait_activity, __ATOMIC_SEQ_CST))
+	{
+		__atomic_store_n(&ss->wait_due, true, __ATOMIC_SEQ_CST);
+		ss->schedule();
+	}
+	ss->release();
+}
+
+/*************************************************************************
+*  Function name: send_wait
+*  Description: send WAIT message and arm the wait timer again
+*  Parameter: none
+*  Return: void
+*  Remark: called by a step while the ASA has the value; if the ASA answers meanwhile the
+*          session is IDLE, send() refuses WAIT_MSG and the timer is cancelled by asa_completed()
+*  Modification record:
+*************************************************************************/
+void ServerSession::send_wait()
+{
+	//std::cout<<"wait_timer "<<pthread_self()<<":send WAIT MSG"<<std::endl;
+	uint32_t time = WAIT_TIMEOUT_MS;
+	Option wait_option(Waiting_time, 4, (uint8_t*)&time);
+	uint8_t bits[Option::len_except_value + 4];
+	uint16_t bits_size = wait_option.to_bits(bits, sizeof(bits));
+	if(send(bits, bits_size, WAIT_MSG) == SUCCESS)
+	{
+		// still processing, wait again
+		arm_timer(&wait_node, wait_activity, processing_ms, wait_timer);
+	}
+}
+
+/*************************************************************************
+*  Function name: end_timer
+*  Description: didn't receive a new message in the time the negotiation waits, time it out
+*  Parameter: arg    point to ServerSession
+*  Return: void
+*  Remark: a step resumes the negotiation with the time-out
+*  Modification record:
+*  Lastly modified by Cheng Pang on 15-4-29
+*************************************************************************/
+void ServerSession::end_timer(void* arg)
+{
+	ServerSession* ss = (ServerSession*)arg;
+	// have no new request
+	uint32_t armed_activity = __atomic_load_n(&ss->end_activity, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ss->activity, __ATOMIC_SEQ_CST) == armed_activity)
+	{
+		__atomic_store_n(&ss->expired_activity, armed_activity, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&ss->timed_out, true, __ATOMIC_SEQ_CST);
+		ss->schedule();
+	}
+	ss->release();
 }
 
 /*************************************************************************
@@ -382,38 +722,22 @@ void* ServerSession::end_thread_handler(void* arg){
 *  			 	 buffer_size
 *  			 	 type
 *  Return: ERRNO
-*  Remark:
+*  Remark: the negotiation answers with NEGO_MSG or NEGO_END_MSG, a step sends WAIT_MSG when the wait timer fires
+*          while the ASA is processing
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-4-29
 *************************************************************************/
 ERRNO ServerSession::send(const void* buffer, size_t buffer_size,enum MSG_TYPE type){
     ERRNO rtnval = SUCCESS;
 //    std::cout << cur_state <<" " << type << std::endl;
-    switch (cur_state)
+    switch (get_cur_state())
     {
         case IDLE:
         	switch (type)
 			{
 				case NEGO_MSG:
-					// send NEGO_MSG MSG
-					rtnval = write_pdu(buffer,buffer_size, type,session_id);
-					if(rtnval == SUCCESS)
-					{
-						set_cur_state(IDLE);
-						// launch end thread
-						pthread_t tid;
-						idle_check = 0;
-						pthread_create(&tid, NULL, end_thread_handler, this);
-
-					}
-					break;
 				case NEGO_END_MSG:
-					// send ENDING MSG
-					rtnval = write_pdu(buffer,buffer_size,type,session_id);
-					if(rtnval == SUCCESS)
-					{
-						set_cur_state(SESSION_END);
-					}
+					rtnval = sm->write_connection(r,conn,buffer,buffer_size,type,session_id);
 					break;
 				default:
 					rtnval = MSG_TYPE_ERR;
@@ -425,7 +749,7 @@ ERRNO ServerSession::send(const void* buffer, size_t buffer_size,enum MSG_TYPE t
             {
                 case WAIT_MSG:
                     // send WAIT MSG
-                    rtnval = write_pdu((char*)buffer,buffer_size,type,session_id);
+                    rtnval = sm->write_connection(r,conn,buffer,buffer_size,type,session_id);
                     break;
                 default:
                     rtnval = MSG_TYPE_ERR;
@@ -442,54 +766,3 @@ ERRNO ServerSession::send(const void* buffer, size_t buffer_size,enum MSG_TYPE t
     }
     return rtnval;
 }
-
-/*************************************************************************
-*  Function name: set_state
-*  Description: set session state by the message type
-*  Parameter: type    message type
-*  Return: ERRNO
-*  Remark:
-*  Modification record:
-*  Lastly modified by Cheng Pang on 15-5-20
-*************************************************************************/
-ERRNO ServerSession::set_state(enum MSG_TYPE type){
-    ERRNO rtnval;
-    switch (cur_state)
-    {
-        case IDLE:
-            switch (type)
-            {
-                case REQUEST_MSG:
-                    // update state into PROCESSING
-                    set_cur_state(PROCESSING);
-                    rtnval = SUCCESS;
-                    break;
-                case NEGO_MSG:
-                	set_cur_state(PROCESSING);
-                	rtnval = SUCCESS;
-                	break;
-                case NEGO_END_MSG:
-					set_cur_state(SESSION_END);
-                    rtnval = SUCCESS;
-                    break;
-                default:
-                    rtnval = SERVER_RECV_UNEXCEPTED_MSG_TYPE_ERR;
-                    break;
-            }
-            break;
-        case PROCESSING:
-            dieWithUserMessager("Server doesn't allowed recv ANY MSG in state PROCESSING");
-            rtnval = ERROR;
-            break;
-        case SESSION_END:
-            dieWithUserMessager("Server doesn't allowed recv ANY MSG in state SESSION_END");
-            rtnval = ERROR;
-            break;
-        default:
-            rtnval = SERVER_UNEXCEPTED_STATE_ERR;
-            break;
-    }
-    return rtnval;
-}
-
-
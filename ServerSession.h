@@ -25,12 +25,20 @@
 #ifndef ServerSession_H
 #define ServerSession_H
 
-#include <queue>
 #include "BaseNegotiator.h"
+#include "Mailbox.h"
+#include "DuplicateWindow.h"
+#include "NegotiationTask.h"
+#include "TimerWheel.h"
 #include "common_structs.h"
 #include "Errno.h"
 #include <pthread.h>
 
+// messages a session holds before the reactor drops more, a power of two
+#define SESSION_MAILBOX_SIZE 8
+// recent messages of a session a retransmit is recognised among, a power of two
+#define SESSION_DUPLICATE_WINDOW 8
+
 // server state
 enum server_states{
     IDLE = 0,
@@ -39,56 +47,143 @@ enum server_states{
 };
 
 class ServerMaster;
+class ServerSession;
+struct reactor;
+struct objective_entry;
+
+// a value of the peer handed to the ASA by ServerMaster::asa_negotiate_async(); the ASA writes
+// its answer to answer() and calls complete() once, from any thread, now or later. The
+// completion belongs to the session, the ASA must not touch it after complete()
+class AsaCompletion{
+public:
+    // the value proposed, a copy valid until complete(); a zero follows it for ASAs taking C strings
+    const uint8_t* value(){return proposed;}
+    uint16_t len(){return proposed_len;}
+    // where the answer goes, at most answer_capacity() octets
+    uint8_t* answer(){return answer_buf;}
+    uint16_t answer_capacity(){return capacity;}
+    // rtnval SUCCESS with the answer in answer_len octets, anything else for no answer
+    void complete(ERRNO rtnval, uint16_t answer_len);
+
+private:
+    friend class ServerSession;
+    ServerSession *session;
+    // the objective of the value, NULL for the hooks of ServerMaster
+    struct objective_entry *objective;
+    uint8_t proposed[MAXSTRINGLENGTH + 1];
+    uint16_t proposed_len;
+    uint8_t *answer_buf;
+    uint16_t capacity;
+    // set by complete()
+    ERRNO result;
+    uint16_t answered_len;
+};
 
-// a negotiation session of Server
+// a negotiation session of Server; the negotiation is a coroutine, resumed by
+// steps run as tasks on the ThreadPool of its ServerMaster, one step whenever it
+// has messages, its wait timed out or the ASA answered, and never on two workers at once
 class ServerSession:public BaseNegotiator{
+    friend class AsaCompletion;
 private:
-    // pointer to the queue
-    std::queue<content> *q;
+    // messages from the reactor waiting for a step
+    Mailbox<content, SESSION_MAILBOX_SIZE> mailbox;
+    // the negotiation, suspended between messages
+    NegotiationTask negotiation;
     // session id
     uint32_t session_id;
+    // whether session_id was reserved in UniqueSessionId by this session
+    bool owns_session_id;
     // current state
     enum server_states cur_state;
     // statelock
     pthread_mutex_t statelock;
-    // queuelock
-    pthread_mutex_t queuelock;
-
 
+    ServerMaster* sm;
+    // reactor the session belongs to
+    struct reactor* r;
+    // connection the session runs on, kept open until the session ends
+    connection* conn;
+    // held by the session table, by a step queued or running, and by each timer armed;
+    // the session is deleted when the last one is released
+    int refs;
+    // a step is queued or running
+    int scheduled;
+    // messages taken from the mailbox so far
+    uint32_t activity;
+    // timers on the wheel of the reactor, with the activity when they were armed;
+    // a timer firing as a message is taken finds the activity moved on
+    timer_node wait_node;
+    uint32_t wait_activity;
+    timer_node end_node;
+    uint32_t end_activity;
+    // end_node fired, with the activity it saw; a step times the negotiation out
+    // unless a message was taken since
+    bool timed_out;
+    uint32_t expired_activity;
+    // wait_node fired, a step sends WAIT_MSG if the ASA still has the value
+    bool wait_due;
+    // the session has been cleared from ServerMaster
+    bool ended;
+    // the value with the ASA, at most one at a time; the ASA holds a reference until it completes
+    AsaCompletion asa;
+    // the ASA completed, a step resumes the negotiation
+    int asa_answered;
+    // WAIT_MSG interval of the objective with the ASA
+    unsigned int processing_ms;
+    // fingerprints of the recent messages, to filter out retransmits
+    DuplicateWindow<SESSION_DUPLICATE_WINDOW> recent;
+
+    // take a reference, false if the session is being deleted
+    bool acquire();
+    // queue a step unless one is queued or running
+    void schedule();
+    // resume the negotiation with the messages queued or its time-out, end the session once it returns
+    void step();
+    // the negotiation of the session, one objective exchanged per PDU
+    NegotiationTask negotiate();
+    void arm_timer(timer_node *t, uint32_t &armed_activity, unsigned int ms, void (*fn)(void *));
+    void cancel_timer(timer_node *t);
+    // hand a value to the handler of objective, the negotiation co_awaits NegotiationTask::completion(&asa_answered) then
+    void dispatch_asa(struct objective_entry *objective, const uint8_t *value, uint16_t len, uint8_t *answer, uint16_t capacity);
+    // called by AsaCompletion::complete()
+    void asa_completed();
+    // tell the peer the ASA is still processing, and wait processing_ms again
+    void send_wait();
+
+    static void step_task(void* arg);
+    // hand the value of dispatch_asa() to the ASA, on a worker of its own
+    static void asa_task(void* arg);
+    // processing_ms after the value went to the ASA without an answer, send WAIT_MSG
+    static void wait_timer(void* arg);
+    // the negotiation waited for a message longer than it allows
+    static void end_timer(void* arg);
 
 public:
-    // constructor
-    ServerSession(int nsocket,uint32_t session_id,content c);
+    // constructor, the session starts with a reference held for the session table
+    ServerSession(ServerMaster* sm, struct reactor* r, connection* conn, uint32_t session_id, content c, bool owns_session_id = false);
 
     // destructor
 	~ServerSession();
 
-    // push into queue
-    void queue_push(content c);
-    // pop from queue
-    content queue_pop();
-    // determine if queue is empty
-    bool queue_empty();
+    // queue a message and run a step for it, false if the mailbox is full
+    bool deliver(const content &c);
+    // give a reference back, the last one retires the session from its table
+    void release();
+
+    bool get_owns_session_id(){return owns_session_id;}
 
     // set/get current state
     enum server_states get_cur_state();
     void set_cur_state(enum server_states state);
 
-    // thread running function 
-    static void* run_help(void* arg);
-    void run(ServerMaster* sm);
-
-    // thread to send WAIT_MSG
-    static void* wait_thread_handler(void* arg);
-
-    // thread to cheack if the session ends
-    static void* end_thread_handler(void* arg);
+    // queue the first step, once the session is in the session table
+    void start();
+    // the server stops with the session unfinished: disarm its timers, give its id back and
+    // drop the reference of the table, once the pool has drained and the reactor is stopped
+    void abandon();
 
-    // update state
-    ERRNO  set_state(enum MSG_TYPE type);
     // send
     ERRNO send(const void* buffer, size_t buffer_size,enum MSG_TYPE type);
-    int idle_check;
 };
 
 #endif /* defined(__demo__ServerSession__) */
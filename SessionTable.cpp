@@ -0,0 +1,496 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[SessionTable.cpp]
+* Description:Implementation of class SessionTable and class EpochDomain
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "SessionTable.h"
+#include "ServerSession.h"
+#include <sched.h>
+
+// keys of slots never used and of slots whose session was removed;
+// a session id has 24 bits, so no live key reaches them
+static const uint64_t EMPTY_KEY = ~(uint64_t)0;
+static const uint64_t REMOVED_KEY = ~(uint64_t)0 - 1;
+
+/*************************************************************************
+*  Function name: EpochDomain::EpochDomain
+*  Description: constructor
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+EpochDomain::EpochDomain()
+{
+    epoch = 1;
+    for(int i = 0; i < MAX_READERS; i++)
+    {
+        readers[i] = 0;
+    }
+    pthread_mutex_init(&retired_lock, NULL);
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::~EpochDomain
+*  Description: destructor, frees everything still retired
+*  Parameter: none
+*  Return: none
+*  Remark: no reader may be active
+*  Modification record:
+*************************************************************************/
+EpochDomain::~EpochDomain()
+{
+    flush();
+    pthread_mutex_destroy(&retired_lock);
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::flush
+*  Description: free everything still retired
+*  Parameter: none
+*  Return: void
+*  Remark: no reader may be active; what free_fn retires meanwhile is freed too
+*  Modification record:
+*************************************************************************/
+void EpochDomain::flush()
+{
+    pthread_mutex_lock(&retired_lock);
+    while(!retired_list.empty())
+    {
+        std::vector<retired> list;
+        list.swap(retired_list);
+        pthread_mutex_unlock(&retired_lock);
+        for(size_t i = 0; i < list.size(); i++)
+        {
+            list[i].free_fn(list[i].p);
+        }
+        pthread_mutex_lock(&retired_lock);
+    }
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::enter
+*  Description: start a read section
+*  Parameter: none
+*  Return: int   the slot announcing the reader, to pass to leave
+*  Remark: the announcement is made before any shared pointer is read, so memory
+*          retired after the epoch was read stays allocated until leave
+*  Modification record:
+*************************************************************************/
+int EpochDomain::enter()
+{
+    int start = (int)((size_t)pthread_self() % MAX_READERS);
+    for(;;)
+    {
+        uint64_t e = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+        for(int n = 0; n < MAX_READERS; n++)
+        {
+            int i = (start + n) % MAX_READERS;
+            uint64_t expected = 0;
+            if(__atomic_compare_exchange_n(&readers[i], &expected, e + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            {
+                return i;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::leave
+*  Description: end a read section
+*  Parameter: slot   returned by enter
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void EpochDomain::leave(int slot)
+{
+    __atomic_store_n(&readers[slot], 0, __ATOMIC_SEQ_CST);
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::retire
+*  Description: free memory no longer reachable once no reader can be using it
+*  Parameter: p         memory already unlinked from every shared structure
+*  	          free_fn   frees p
+*  Return: void
+*  Remark: frees whatever earlier calls retired and is safe to free by now
+*  Modification record:
+*************************************************************************/
+void EpochDomain::retire(void *p, void (*free_fn)(void *))
+{
+    retired r;
+    r.p = p;
+    r.free_fn = free_fn;
+    pthread_mutex_lock(&retired_lock);
+    // readers entering from now on read the epoch after p was unlinked
+    r.epoch = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+    retired_list.push_back(r);
+    reclaim();
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/*************************************************************************
+*  Function name: EpochDomain::reclaim
+*  Description: free the memory retired before the oldest active reader entered
+*  Parameter: none
+*  Return: void
+*  Remark: retired_lock must be held
+*  Modification record:
+*************************************************************************/
+void EpochDomain::reclaim()
+{
+    uint64_t oldest = ~(uint64_t)0;
+    for(int i = 0; i < MAX_READERS; i++)
+    {
+        uint64_t r = __atomic_load_n(&readers[i], __ATOMIC_SEQ_CST);
+        if(r != 0 && r - 1 < oldest)
+        {
+            oldest = r - 1;
+        }
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < retired_list.size(); i++)
+    {
+        if(retired_list[i].epoch < oldest)
+        {
+            retired_list[i].free_fn(retired_list[i].p);
+        }
+        else
+        {
+            retired_list[kept++] = retired_list[i];
+        }
+    }
+    retired_list.resize(kept);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::SessionTable
+*  Description: constructor
+*  Parameter: capacity   slots to start with, rounded up to a power of two
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+SessionTable::SessionTable(size_t capacity)
+{
+    size_t c = INITIAL_CAPACITY;
+    while(c < capacity)
+    {
+        c *= 2;
+    }
+    table = new_slots(c);
+    live = 0;
+    used = 0;
+    pthread_mutex_init(&write_lock, NULL);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::~SessionTable
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark: the sessions still in the table are not deleted
+*  Modification record:
+*************************************************************************/
+SessionTable::~SessionTable()
+{
+    free_slots(table);
+    pthread_mutex_destroy(&write_lock);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::find
+*  Description: look a session up without taking a lock
+*  Parameter: session_id
+*  	          fd         connection the session runs on
+*  Return: ServerSession*   NULL if there is none
+*  Remark: call between read_lock() and read_unlock()
+*  Modification record:
+*************************************************************************/
+ServerSession* SessionTable::find(uint32_t session_id, int fd)
+{
+    uint64_t key = make_key(session_id, fd);
+    slots *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+    size_t mask = t->capacity - 1;
+    size_t i = hash(key) & mask;
+    for(size_t n = 0; n < t->capacity; n++, i = (i + 1) & mask)
+    {
+        uint64_t k = __atomic_load_n(&t->entries[i].key, __ATOMIC_ACQUIRE);
+        if(k == EMPTY_KEY)
+        {
+            return NULL;
+        }
+        if(k == key)
+        {
+            // NULL when the session is being removed, a new one may follow
+            ServerSession *ss = __atomic_load_n(&t->entries[i].ss, __ATOMIC_ACQUIRE);
+            if(ss != NULL)
+            {
+                return ss;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::insert
+*  Description: add a session
+*  Parameter: session_id
+*  	          fd         connection the session runs on
+*  	          ss
+*  Return: ERRNO   SESSION_EXISTS_ERR if the key is in the table already
+*  Remark: only empty slots are taken, so a reader that matched a key never
+*          reads the session of another key from that slot
+*  Modification record:
+*************************************************************************/
+ERRNO SessionTable::insert(uint32_t session_id, int fd, ServerSession* ss)
+{
+    uint64_t key = make_key(session_id, fd);
+    pthread_mutex_lock(&write_lock);
+    // keep at least a quarter of the slots empty, so probes stay short
+    if((used + 1) * 4 > table->capacity * 3)
+    {
+        rebuild((live + 1) * 2 > table->capacity ? table->capacity * 2 : table->capacity);
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t i = hash(key) & mask;
+    while(table->entries[i].key != EMPTY_KEY)
+    {
+        if(table->entries[i].key == key && table->entries[i].ss != NULL)
+        {
+            pthread_mutex_unlock(&write_lock);
+            return SESSION_EXISTS_ERR;
+        }
+        i = (i + 1) & mask;
+    }
+    // the session is in place before readers can match the key
+    __atomic_store_n(&table->entries[i].ss, ss, __ATOMIC_RELEASE);
+    __atomic_store_n(&table->entries[i].key, key, __ATOMIC_RELEASE);
+    used++;
+    live++;
+    pthread_mutex_unlock(&write_lock);
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::remove
+*  Description: take a session out of the table
+*  Parameter: session_id
+*  	          fd         connection the session runs on
+*  Return: ServerSession*   NULL if it is not in the table
+*  Remark: readers may still hold the session, free it with retire()
+*  Modification record:
+*************************************************************************/
+ServerSession* SessionTable::remove(uint32_t session_id, int fd)
+{
+    uint64_t key = make_key(session_id, fd);
+    ServerSession *ss = NULL;
+    pthread_mutex_lock(&write_lock);
+    size_t mask = table->capacity - 1;
+    size_t i = hash(key) & mask;
+    while(table->entries[i].key != EMPTY_KEY)
+    {
+        if(table->entries[i].key == key && table->entries[i].ss != NULL)
+        {
+            ss = table->entries[i].ss;
+            __atomic_store_n(&table->entries[i].ss, (ServerSession *)NULL, __ATOMIC_RELEASE);
+            __atomic_store_n(&table->entries[i].key, REMOVED_KEY, __ATOMIC_RELEASE);
+            live--;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    pthread_mutex_unlock(&write_lock);
+    return ss;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::retire
+*  Description: delete a removed session once no reader can still be using it
+*  Parameter: ss
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void SessionTable::retire(ServerSession* ss)
+{
+    epoch.retire(ss, free_session);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::remove_all
+*  Description: take every session out of the table
+*  Parameter: sessions   the sessions taken out are appended to it
+*  Return: void
+*  Remark: at shutdown, once nothing looks sessions up or ends them; the table holds
+*          a reference to each, the caller gives them back
+*  Modification record:
+*************************************************************************/
+void SessionTable::remove_all(std::vector<ServerSession*> &sessions)
+{
+    pthread_mutex_lock(&write_lock);
+    for(size_t i = 0; i < table->capacity; i++)
+    {
+        if(table->entries[i].key != EMPTY_KEY && table->entries[i].key != REMOVED_KEY && table->entries[i].ss != NULL)
+        {
+            sessions.push_back(table->entries[i].ss);
+            table->entries[i].ss = NULL;
+            table->entries[i].key = REMOVED_KEY;
+        }
+    }
+    live = 0;
+    pthread_mutex_unlock(&write_lock);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::size
+*  Description: number of live sessions
+*  Parameter: none
+*  Return: size_t
+*  Remark:
+*  Modification record:
+*************************************************************************/
+size_t SessionTable::size()
+{
+    pthread_mutex_lock(&write_lock);
+    size_t n = live;
+    pthread_mutex_unlock(&write_lock);
+    return n;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::rebuild
+*  Description: move the live sessions to new slots, dropping the removed ones
+*  Parameter: capacity   a power of two
+*  Return: void
+*  Remark: write_lock must be held; readers still in the old slots find what
+*          they found before, the old slots are freed after they leave
+*  Modification record:
+*************************************************************************/
+void SessionTable::rebuild(size_t capacity)
+{
+    slots *old = table;
+    slots *t = new_slots(capacity);
+    size_t mask = capacity - 1;
+    for(size_t j = 0; j < old->capacity; j++)
+    {
+        uint64_t key = old->entries[j].key;
+        if(key == EMPTY_KEY || key == REMOVED_KEY || old->entries[j].ss == NULL)
+        {
+            continue;
+        }
+        size_t i = hash(key) & mask;
+        while(t->entries[i].key != EMPTY_KEY)
+        {
+            i = (i + 1) & mask;
+        }
+        t->entries[i] = old->entries[j];
+    }
+    used = live;
+    __atomic_store_n(&table, t, __ATOMIC_RELEASE);
+    epoch.retire(old, free_slots);
+}
+
+/*************************************************************************
+*  Function name: SessionTable::make_key
+*  Description: key of a session
+*  Parameter: session_id
+*  	          fd         connection the session runs on
+*  Return: uint64_t
+*  Remark: two peers may pick the same session id, the connection tells them apart
+*  Modification record:
+*************************************************************************/
+uint64_t SessionTable::make_key(uint32_t session_id, int fd)
+{
+    return ((uint64_t)(session_id & MAX_SESSION_ID) << 32) | (uint32_t)fd;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::hash
+*  Description: spread a key over the slots
+*  Parameter: key
+*  Return: size_t
+*  Remark: finaliser of splitmix64
+*  Modification record:
+*************************************************************************/
+size_t SessionTable::hash(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)key;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::new_slots
+*  Description: allocate empty slots
+*  Parameter: capacity   a power of two
+*  Return: slots*
+*  Remark:
+*  Modification record:
+*************************************************************************/
+SessionTable::slots* SessionTable::new_slots(size_t capacity)
+{
+    slots *t = new slots;
+    t->capacity = capacity;
+    t->entries = new slot[capacity];
+    for(size_t i = 0; i < capacity; i++)
+    {
+        t->entries[i].key = EMPTY_KEY;
+        t->entries[i].ss = NULL;
+    }
+    return t;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::free_slots
+*  Description: free slots allocated by new_slots
+*  Parameter: p
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void SessionTable::free_slots(void *p)
+{
+    slots *t = (slots *)p;
+    delete [] t->entries;
+    delete t;
+}
+
+/*************************************************************************
+*  Function name: SessionTable::free_session
+*  Description: delete a retired session
+*  Parameter: p
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void SessionTable::free_session(void *p)
+{
+    delete (ServerSession *)p;
+}
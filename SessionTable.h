@@ -0,0 +1,128 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[SessionTable.h]
+* Description:Definition of class SessionTable, the live sessions of a reactor, and of class
+*             EpochDomain, which defers freeing memory until no reader can still see it
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_SessionTable_h
+#define demo_SessionTable_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+#include "Errno.h"
+
+class ServerSession;
+
+// epoch based reclamation: readers announce the epoch they entered in, memory
+// retired in an epoch is freed once every reader announced a later one
+class EpochDomain{
+public:
+    EpochDomain();
+    // frees everything still retired, no reader may be active
+    ~EpochDomain();
+
+    // start a read section, returns the slot to pass to leave
+    int enter();
+    // end a read section
+    void leave(int slot);
+    // free p with free_fn once no reader can be using it
+    void retire(void *p, void (*free_fn)(void *));
+    // free everything still retired now, no reader may be active
+    void flush();
+
+private:
+    enum{
+        // most readers at a time, enter() spins when all are busy
+        MAX_READERS = 64
+    };
+    typedef struct retired{
+        uint64_t epoch;
+        void *p;
+        void (*free_fn)(void *);
+    }retired;
+
+    uint64_t epoch;
+    // 0 for a free slot, otherwise 1 + the epoch its reader entered in
+    uint64_t readers[MAX_READERS];
+    pthread_mutex_t retired_lock;
+    std::vector<retired> retired_list;
+
+    void reclaim();
+};
+
+// open addressing table of the sessions of a reactor, keyed by session id and
+// the connection the session runs on; find() takes no lock, insert() and
+// remove() serialise on a mutex and never reuse a slot until the table is rebuilt
+class SessionTable{
+public:
+    SessionTable(size_t capacity = INITIAL_CAPACITY);
+    // frees the slots, the sessions still in the table are the caller's
+    ~SessionTable();
+
+    // look a session up, call between read_lock() and read_unlock();
+    // the session stays allocated until read_unlock()
+    ServerSession* find(uint32_t session_id, int fd);
+    int read_lock(){return epoch.enter();}
+    void read_unlock(int slot){epoch.leave(slot);}
+
+    ERRNO insert(uint32_t session_id, int fd, ServerSession* ss);
+    // take a session out of the table, NULL if it is not there
+    ServerSession* remove(uint32_t session_id, int fd);
+    // delete a removed session once no reader can still be using it
+    void retire(ServerSession* ss);
+    // take every session out of the table, at shutdown when no reader or writer is left
+    void remove_all(std::vector<ServerSession*> &sessions);
+    // delete the sessions and slots retired so far, no reader may be active
+    void flush(){epoch.flush();}
+    // number of live sessions
+    size_t size();
+
+private:
+    enum{
+        INITIAL_CAPACITY = 64
+    };
+    typedef struct slot{
+        uint64_t key;
+        ServerSession* ss;
+    }slot;
+    typedef struct slots{
+        // a power of two
+        size_t capacity;
+        slot *entries;
+    }slots;
+
+    slots *table;
+    // live entries and removed ones still taking a slot
+    size_t live;
+    size_t used;
+    pthread_mutex_t write_lock;
+    EpochDomain epoch;
+
+    static uint64_t make_key(uint32_t session_id, int fd);
+    static size_t hash(uint64_t key);
+    static slots* new_slots(size_t capacity);
+    static void free_slots(void *p);
+    static void free_session(void *p);
+    void rebuild(size_t capacity);
+};
+
+#endif
@@ -0,0 +1,385 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ThreadPool.cpp]
+* Description:Implementation of class ThreadPool
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "ThreadPool.h"
+#include <unistd.h>
+#include <sched.h>
+
+// pool and worker index of the calling thread, NULL outside of the workers
+static __thread ThreadPool *current_pool = NULL;
+static __thread int current_index = -1;
+
+/*************************************************************************
+*  Function name: ThreadPool::ThreadPool
+*  Description: constructor, no thread runs before start
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ThreadPool::ThreadPool()
+{
+    state = POOL_IDLE;
+    submitting = 0;
+    pending = 0;
+    unfinished = 0;
+    sleepers = 0;
+    stopping = false;
+    next_worker = 0;
+    pthread_mutex_init(&lifecycle_lock, NULL);
+    pthread_mutex_init(&idle_lock, NULL);
+    pthread_cond_init(&idle_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::~ThreadPool
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+ThreadPool::~ThreadPool()
+{
+    stop();
+    pthread_mutex_destroy(&lifecycle_lock);
+    pthread_mutex_destroy(&idle_lock);
+    pthread_cond_destroy(&idle_cond);
+    pthread_cond_destroy(&done_cond);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::start
+*  Description: start the workers
+*  Parameter: worker_count   0 for one per online core
+*  Return: ERRNO   ERROR if started already, or if a thread could not be created
+*  Remark: a thread failing stops and joins those created before it, the pool is not started then
+*  Modification record:
+*************************************************************************/
+ERRNO ThreadPool::start(int worker_count)
+{
+    pthread_mutex_lock(&lifecycle_lock);
+    if(__atomic_load_n(&state, __ATOMIC_SEQ_CST) != POOL_IDLE)
+    {
+        pthread_mutex_unlock(&lifecycle_lock);
+        return ERROR;
+    }
+    if(worker_count <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? (int)cpus : 1;
+    }
+    for(int i = 0; i < worker_count; i++)
+    {
+        worker *w = new worker;
+        w->pool = this;
+        w->index = i;
+        pthread_mutex_init(&w->lock, NULL);
+        workers.push_back(w);
+    }
+    // every deque exists before any worker looks for one to steal from
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        if(pthread_create(&workers[i]->tid, NULL, run_help, workers[i]) != 0)
+        {
+            dieWithUserMessager("pthread_create failed");
+            join_workers(i);
+            pthread_mutex_unlock(&lifecycle_lock);
+            return ERROR;
+        }
+    }
+    __atomic_store_n(&state, POOL_RUNNING, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lifecycle_lock);
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::stop
+*  Description: stop and join the threads
+*  Parameter: none
+*  Return: void
+*  Remark: the workers exit once every deque is empty, so the tasks queued still run and
+*          the references they hold are given back; a hold not released blocks it. The
+*          submissions racing with it are queued before the threads are joined, and those
+*          coming after it run on their callers
+*  Modification record:
+*************************************************************************/
+void ThreadPool::stop()
+{
+    pthread_mutex_lock(&lifecycle_lock);
+    if(__atomic_load_n(&state, __ATOMIC_SEQ_CST) != POOL_RUNNING)
+    {
+        pthread_mutex_unlock(&lifecycle_lock);
+        return;
+    }
+    wait_idle();
+    __atomic_store_n(&state, POOL_STOPPED, __ATOMIC_SEQ_CST);
+    // a submit() that saw POOL_RUNNING queues its task, the rest run theirs themselves
+    while(__atomic_load_n(&submitting, __ATOMIC_SEQ_CST) > 0)
+    {
+        sched_yield();
+    }
+    wait_idle();
+    join_workers(workers.size());
+    __atomic_store_n(&state, POOL_IDLE, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lifecycle_lock);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::join_workers
+*  Description: make the workers exit, join them and free every worker
+*  Parameter: started   workers whose thread was created, the first ones
+*  Return: void
+*  Remark: lifecycle_lock held, with no submit() looking at workers
+*  Modification record:
+*************************************************************************/
+void ThreadPool::join_workers(size_t started)
+{
+    pthread_mutex_lock(&idle_lock);
+    stopping = true;
+    pthread_cond_broadcast(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+
+    for(size_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i]->tid, NULL);
+    }
+    // a worker still running looks into the deques of the others, none goes before all are joined
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        pthread_mutex_destroy(&workers[i]->lock);
+        delete workers[i];
+    }
+    workers.clear();
+    stopping = false;
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::submit
+*  Description: queue fn(arg) to run on a worker
+*  Parameter: fn
+*  	          arg
+*  Return: void
+*  Remark: a worker queues on its own deque, where it runs it next; other
+*          threads spread their tasks over the workers in turn. Not started or
+*          stopping, fn(arg) runs on the calling thread instead
+*  Modification record:
+*************************************************************************/
+void ThreadPool::submit(void (*fn)(void *), void *arg)
+{
+    task t;
+    t.fn = fn;
+    t.arg = arg;
+    // pairs with stop() storing the state before it waits for submitting, so either
+    // this sees the pool stopping or stop() waits for the task to be queued
+    __atomic_add_fetch(&submitting, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&state, __ATOMIC_SEQ_CST) != POOL_RUNNING)
+    {
+        __atomic_sub_fetch(&submitting, 1, __ATOMIC_SEQ_CST);
+        fn(arg);
+        return;
+    }
+    __atomic_add_fetch(&unfinished, 1, __ATOMIC_SEQ_CST);
+    worker *w;
+    if(current_pool == this)
+    {
+        w = workers[current_index];
+    }
+    else
+    {
+        w = workers[__atomic_fetch_add(&next_worker, 1, __ATOMIC_RELAXED) % workers.size()];
+    }
+    pthread_mutex_lock(&w->lock);
+    w->tasks.push_back(t);
+    pthread_mutex_unlock(&w->lock);
+
+    // pairs with the sleeper count raised before a worker checks pending, so
+    // either the worker sees the task or this sees the worker
+    __atomic_add_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    __atomic_sub_fetch(&submitting, 1, __ATOMIC_SEQ_CST);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::hold
+*  Description: keep the pool from being idle while work outside of it goes on
+*  Parameter: none
+*  Return: void
+*  Remark: released by unhold(); the holder submits what the work needs before it
+*          releases, so wait_idle() never sees the pool idle in between
+*  Modification record:
+*************************************************************************/
+void ThreadPool::hold()
+{
+    __atomic_add_fetch(&unfinished, 1, __ATOMIC_SEQ_CST);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::unhold
+*  Description: release a hold()
+*  Parameter: none
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ThreadPool::unhold()
+{
+    finish();
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::wait_idle
+*  Description: wait until every task submitted has run and every hold is released
+*  Parameter: none
+*  Return: void
+*  Remark: not from a worker; whoever could submit besides the workers and the holders
+*          must have stopped, or the pool may be busy again as it returns
+*  Modification record:
+*************************************************************************/
+void ThreadPool::wait_idle()
+{
+    pthread_mutex_lock(&idle_lock);
+    while(__atomic_load_n(&unfinished, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_cond_wait(&done_cond, &idle_lock);
+    }
+    pthread_mutex_unlock(&idle_lock);
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::finish
+*  Description: a task ran to its end or a hold is released
+*  Parameter: none
+*  Return: void
+*  Remark: a task submitting another does so before it finishes, so unfinished
+*          only drops to 0 once nothing is left to run
+*  Modification record:
+*************************************************************************/
+void ThreadPool::finish()
+{
+    if(__atomic_sub_fetch(&unfinished, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::take
+*  Description: take a task for a worker
+*  Parameter: w   the worker
+*  	          t   the task taken
+*  Return: bool   false if every deque is empty
+*  Remark: the newest task of its own deque, else the oldest of another
+*  Modification record:
+*************************************************************************/
+bool ThreadPool::take(worker *w, task &t)
+{
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if(!w->tasks.empty())
+    {
+        t = w->tasks.back();
+        w->tasks.pop_back();
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for(size_t n = 1; !found && n < workers.size(); n++)
+    {
+        worker *victim = workers[(w->index + n) % workers.size()];
+        pthread_mutex_lock(&victim->lock);
+        if(!victim->tasks.empty())
+        {
+            t = victim->tasks.front();
+            victim->tasks.pop_front();
+            found = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if(found)
+    {
+        __atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+    }
+    return found;
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::run
+*  Description: loop of a worker
+*  Parameter: w   the worker
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void ThreadPool::run(worker *w)
+{
+    current_pool = this;
+    current_index = w->index;
+    for(;;)
+    {
+        task t;
+        if(take(w, t))
+        {
+            t.fn(t.arg);
+            finish();
+            continue;
+        }
+
+        pthread_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&pending, __ATOMIC_SEQ_CST) <= 0 && !stopping)
+        {
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        }
+        __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        // stopping, but not before the tasks queued have run
+        bool stop_now = stopping && __atomic_load_n(&pending, __ATOMIC_SEQ_CST) <= 0;
+        pthread_mutex_unlock(&idle_lock);
+        if(stop_now)
+        {
+            break;
+        }
+    }
+}
+
+/*************************************************************************
+*  Function name: ThreadPool::run_help
+*  Description: static function for a worker thread
+*  Parameter: arg   the worker
+*  Return: void*
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void* ThreadPool::run_help(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->pool->run(w);
+    return (void*)0;
+}
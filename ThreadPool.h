@@ -0,0 +1,103 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[ThreadPool.h]
+* Description:Definition of class ThreadPool, a fixed set of worker threads running the steps
+*             of the server sessions
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_ThreadPool_h
+#define demo_ThreadPool_h
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include "Errno.h"
+
+// a unit of work, fn(arg)
+typedef struct task{
+    void (*fn)(void *);
+    void *arg;
+}task;
+
+// every worker has its own deque, it takes the newest task of its own and
+// steals the oldest task of another when it has none
+class ThreadPool{
+public:
+    ThreadPool();
+    // stops the threads, see stop()
+    ~ThreadPool();
+
+    // start worker_count workers, 0 for one per online core; ERROR if started already,
+    // or if a thread fails, with none left running then
+    ERRNO start(int worker_count = 0);
+    // wait for the tasks queued, those they submit and the holds to be done, then join
+    // the threads; from any thread but a worker, once or more
+    void stop();
+
+    // run fn(arg) on a worker; on the calling thread, before it returns, while the pool
+    // is not started or once stop() has begun to join the threads
+    void submit(void (*fn)(void *), void *arg);
+    // work going on outside of the workers that will submit to the pool when it is done;
+    // the pool is not idle until it is released
+    void hold();
+    void unhold();
+    // wait until every task submitted has run and every hold is released
+    void wait_idle();
+
+private:
+    typedef struct worker{
+        ThreadPool *pool;
+        int index;
+        pthread_t tid;
+        pthread_mutex_t lock;
+        std::deque<task> tasks;
+    }worker;
+
+    enum{ POOL_IDLE = 0, POOL_RUNNING = 1, POOL_STOPPED = 2 };
+
+    // set while no submit() can look at it, see state and submitting
+    std::vector<worker*> workers;
+    // POOL_RUNNING from start() until stop() begins to join the threads
+    int state;
+    // submit() calls that may have seen POOL_RUNNING, stop() waits for them to queue
+    int submitting;
+    // held by start() and stop() throughout
+    pthread_mutex_t lifecycle_lock;
+    // tasks queued on all the workers
+    int pending;
+    // tasks submitted and not run to their end, and holds
+    int unfinished;
+    // workers waiting on idle_cond
+    int sleepers;
+    bool stopping;
+    unsigned int next_worker;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    // signalled as unfinished drops to 0
+    pthread_cond_t done_cond;
+
+    bool take(worker *w, task &t);
+    void finish();
+    // make the workers started exit, join them and free every worker
+    void join_workers(size_t started);
+    void run(worker *w);
+    static void* run_help(void *arg);
+};
+
+#endif
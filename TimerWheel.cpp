@@ -0,0 +1,393 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[TimerWheel.cpp]
+* Description:Implementation of class TimerWheel
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "TimerWheel.h"
+#include <time.h>
+#include <limits.h>
+#include <vector>
+
+// the farthest a timer is placed ahead, later ones are placed here and placed again when they get there
+static const uint64_t MAX_DELTA = ((uint64_t)1 << 30) - 1;
+
+/*************************************************************************
+*  Function name: timer_node_init
+*  Description: initiate a timer before its first use
+*  Parameter: t
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void timer_node_init(timer_node *t)
+{
+    t->prev = t;
+    t->next = t;
+    t->expires = 0;
+    t->fn = NULL;
+    t->arg = NULL;
+    t->armed = false;
+    t->level = 0;
+    t->slot = 0;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::TimerWheel
+*  Description: constructor
+*  Parameter: none
+*  Return: none
+*  Remark:
+*  Modification record:
+*************************************************************************/
+TimerWheel::TimerWheel()
+{
+    current = now_ms();
+    count = 0;
+    for(int l = 0; l < LEVELS; l++)
+    {
+        for(int s = 0; s < SLOTS; s++)
+        {
+            timer_node_init(&slots[l][s]);
+        }
+        occupied[l] = 0;
+    }
+    wake_at = ~(uint64_t)0;
+    wake = NULL;
+    wake_arg = NULL;
+    pthread_mutex_init(&lock, NULL);
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::~TimerWheel
+*  Description: destructor
+*  Parameter: none
+*  Return: none
+*  Remark: timers still armed are left as they are
+*  Modification record:
+*************************************************************************/
+TimerWheel::~TimerWheel()
+{
+    pthread_mutex_destroy(&lock);
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::set_waker
+*  Description: set the function waking the driving thread
+*  Parameter: wake
+*  	          arg
+*  Return: void
+*  Remark: call before any timer is armed
+*  Modification record:
+*************************************************************************/
+void TimerWheel::set_waker(void (*wake)(void *), void *arg)
+{
+    this->wake = wake;
+    this->wake_arg = arg;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::arm
+*  Description: arm a timer
+*  Parameter: t
+*  	          ms     milliseconds from now
+*  	          fn     called on the driving thread when it expires, t may be armed again from it
+*  	          arg
+*  Return: bool   false if t is armed already
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool TimerWheel::arm(timer_node *t, unsigned int ms, void (*fn)(void *), void *arg)
+{
+    uint64_t expires = now_ms() + ms;
+    pthread_mutex_lock(&lock);
+    if(t->armed)
+    {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    t->expires = expires;
+    t->fn = fn;
+    t->arg = arg;
+    t->armed = true;
+    count++;
+    link(t);
+    bool earlier = expires < wake_at;
+    if(earlier)
+    {
+        wake_at = expires;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if(earlier && wake != NULL)
+    {
+        wake(wake_arg);
+    }
+    return true;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::cancel
+*  Description: disarm a timer
+*  Parameter: t
+*  Return: bool   false if it was not armed, a timer being fired is not armed any more
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool TimerWheel::cancel(timer_node *t)
+{
+    pthread_mutex_lock(&lock);
+    bool was_armed = t->armed;
+    if(was_armed)
+    {
+        unlink(t);
+        t->armed = false;
+        count--;
+    }
+    pthread_mutex_unlock(&lock);
+    return was_armed;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::wait_ms
+*  Description: how long the driving thread may sleep
+*  Parameter: none
+*  Return: int   milliseconds, -1 if no timer is armed
+*  Remark: timers armed to expire earlier call the waker until the driver calls expire()
+*  Modification record:
+*************************************************************************/
+int TimerWheel::wait_ms()
+{
+    pthread_mutex_lock(&lock);
+    if(count == 0)
+    {
+        wake_at = ~(uint64_t)0;
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    wake_at = next_tick();
+    pthread_mutex_unlock(&lock);
+
+    uint64_t now = now_ms();
+    if(wake_at <= now)
+    {
+        return 0;
+    }
+    return wake_at - now > INT_MAX ? INT_MAX : (int)(wake_at - now);
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::expire
+*  Description: turn the wheel to now and call the timers expired
+*  Parameter: none
+*  Return: void
+*  Remark: skips straight to the next tick with work, the callbacks run without the lock
+*  Modification record:
+*************************************************************************/
+void TimerWheel::expire()
+{
+    uint64_t now = now_ms();
+    std::vector<timer_node> fired;
+
+    pthread_mutex_lock(&lock);
+    while(current <= now)
+    {
+        if(count == 0)
+        {
+            current = now + 1;
+            break;
+        }
+        uint64_t tick = next_tick();
+        if(tick > now)
+        {
+            current = now + 1;
+            break;
+        }
+        current = tick;
+        // a level is due when the ticks of every level below it wrap around
+        for(int l = 1; l < LEVELS; l++)
+        {
+            if((tick & (((uint64_t)1 << (LEVEL_BITS * l)) - 1)) != 0)
+            {
+                break;
+            }
+            cascade(l, tick);
+        }
+
+        timer_node *head = &slots[0][tick & (SLOTS - 1)];
+        while(head->next != head)
+        {
+            timer_node *t = head->next;
+            unlink(t);
+            if(t->expires > tick)
+            {
+                // was beyond MAX_DELTA when armed
+                link(t);
+                continue;
+            }
+            t->armed = false;
+            count--;
+            // copied, so the owner may arm t again before its callback runs
+            fired.push_back(*t);
+        }
+        current = tick + 1;
+    }
+    wake_at = ~(uint64_t)0;
+    pthread_mutex_unlock(&lock);
+
+    for(size_t i = 0; i < fired.size(); i++)
+    {
+        fired[i].fn(fired[i].arg);
+    }
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::now_ms
+*  Description: CLOCK_MONOTONIC in milliseconds, the ticks of the wheel
+*  Parameter: none
+*  Return: uint64_t
+*  Remark:
+*  Modification record:
+*************************************************************************/
+uint64_t TimerWheel::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::link
+*  Description: put a timer in the slot for its expiry
+*  Parameter: t
+*  Return: void
+*  Remark: lock must be held
+*  Modification record:
+*************************************************************************/
+void TimerWheel::link(timer_node *t)
+{
+    uint64_t expires = t->expires < current ? current : t->expires;
+    if(expires - current > MAX_DELTA)
+    {
+        expires = current + MAX_DELTA;
+    }
+    uint64_t delta = expires - current;
+    int level = 0;
+    while(level < LEVELS - 1 && delta >= ((uint64_t)1 << (LEVEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+    int slot = (int)((expires >> (LEVEL_BITS * level)) & (SLOTS - 1));
+
+    timer_node *head = &slots[level][slot];
+    t->level = level;
+    t->slot = slot;
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+    occupied[level] |= (uint64_t)1 << slot;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::unlink
+*  Description: take a timer out of its slot
+*  Parameter: t
+*  Return: void
+*  Remark: lock must be held
+*  Modification record:
+*************************************************************************/
+void TimerWheel::unlink(timer_node *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    timer_node *head = &slots[t->level][t->slot];
+    if(head->next == head)
+    {
+        occupied[t->level] &= ~((uint64_t)1 << t->slot);
+    }
+    t->prev = t;
+    t->next = t;
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::cascade
+*  Description: move the timers of the slot of a level that is due to the levels below
+*  Parameter: level   1 or more
+*  	          tick    the tick turning, current
+*  Return: void
+*  Remark: lock must be held
+*  Modification record:
+*************************************************************************/
+void TimerWheel::cascade(int level, uint64_t tick)
+{
+    timer_node *head = &slots[level][(tick >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+    while(head->next != head)
+    {
+        timer_node *t = head->next;
+        unlink(t);
+        link(t);
+    }
+}
+
+/*************************************************************************
+*  Function name: TimerWheel::next_tick
+*  Description: the next tick from current with a timer to fire or a slot to cascade
+*  Parameter: none
+*  Return: uint64_t
+*  Remark: lock must be held and a timer armed; the bitmaps make it a few
+*          instructions per level
+*  Modification record:
+*************************************************************************/
+uint64_t TimerWheel::next_tick()
+{
+    uint64_t best = ~(uint64_t)0;
+    for(int l = 0; l < LEVELS; l++)
+    {
+        if(occupied[l] == 0)
+        {
+            continue;
+        }
+        int shift = LEVEL_BITS * l;
+        int pos = (int)((current >> shift) & (SLOTS - 1));
+        // slots in the order the wheel reaches them, pos first
+        uint64_t bits = (occupied[l] >> pos) | (occupied[l] << ((SLOTS - pos) & (SLOTS - 1)));
+        uint64_t tick;
+        if(l == 0)
+        {
+            tick = current + __builtin_ctzll(bits);
+        }
+        else
+        {
+            uint64_t distance = __builtin_ctzll(bits);
+            // slot pos of this level was cascaded already unless current sits on its boundary
+            if(distance == 0 && (current & (((uint64_t)1 << shift) - 1)) != 0)
+            {
+                bits &= ~(uint64_t)1;
+                distance = bits != 0 ? __builtin_ctzll(bits) : SLOTS;
+            }
+            tick = ((current >> shift) + distance) << shift;
+        }
+        if(tick < best)
+        {
+            best = tick;
+        }
+    }
+    return best;
+}
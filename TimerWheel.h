@@ -0,0 +1,96 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract :
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File:[TimerWheel.h]
+* Description:Definition of class TimerWheel, hierarchical timing wheels with a tick of one millisecond.
+*			Level 0 has a slot per tick for the next 64 ticks, every further level a slot per 64 slots
+*			of the level below; a timer sits in the lowest level its expiry fits and moves down as the
+*			wheel turns. Arming and cancelling are O(1), expiring is O(1) per timer.
+* Remark:
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_TimerWheel_h
+#define demo_TimerWheel_h
+
+#include <stdint.h>
+#include <pthread.h>
+
+// a timer, embedded in its owner; it must not be freed while armed
+typedef struct timer_node{
+    struct timer_node *prev;
+    struct timer_node *next;
+    // tick it expires at
+    uint64_t expires;
+    void (*fn)(void *);
+    void *arg;
+    bool armed;
+    // slot it sits in while armed
+    unsigned char level;
+    unsigned char slot;
+}timer_node;
+
+void timer_node_init(timer_node *t);
+
+// the thread driving the wheel sleeps for wait_ms() and then calls expire();
+// any thread may arm and cancel
+class TimerWheel{
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    // wake(arg) is called when a timer is armed to expire before the driver wakes up
+    void set_waker(void (*wake)(void *), void *arg);
+
+    // call fn(arg) on the driving thread after ms milliseconds; false if t is armed already
+    bool arm(timer_node *t, unsigned int ms, void (*fn)(void *), void *arg);
+    // false if t is not armed, because it has fired, is firing or was never armed
+    bool cancel(timer_node *t);
+
+    // milliseconds until the wheel has work, -1 if no timer is armed
+    int wait_ms();
+    // turn the wheel to now and call the timers expired
+    void expire();
+
+    static uint64_t now_ms();
+
+private:
+    enum{
+        LEVEL_BITS = 6,
+        SLOTS = 1 << LEVEL_BITS,
+        LEVELS = 5
+    };
+
+    // next tick to handle
+    uint64_t current;
+    // armed timers
+    unsigned long count;
+    timer_node slots[LEVELS][SLOTS];
+    // bit s set when slot s of a level holds a timer
+    uint64_t occupied[LEVELS];
+    // tick the driver sleeps until, when a timer is armed to expire earlier it is woken
+    uint64_t wake_at;
+    void (*wake)(void *);
+    void *wake_arg;
+    pthread_mutex_t lock;
+
+    void link(timer_node *t);
+    void unlink(timer_node *t);
+    void cascade(int level, uint64_t tick);
+    uint64_t next_tick();
+};
+
+#endif
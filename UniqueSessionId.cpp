@@ -0,0 +1,112 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract : 	
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File : [UniqueSessionId.cpp]
+* Description : Implementation of the session id allocator.
+* Remark : 
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#include "UniqueSessionId.h"
+
+uint64_t UniqueSessionId::live_ids[(MAX_SESSION_ID + 1) / WORD_BITS];
+
+/*************************************************************************
+*  Function name: UniqueSessionId::reserve
+*  Description: mark a session id as live
+*  Parameter: uint32_t session_id
+*  Return: true if the id was free, false if it is live already
+*  Remark: claims the bit with an atomic or, so two threads never get the same id
+*  Modification record:
+*************************************************************************/
+bool UniqueSessionId::reserve(uint32_t session_id)
+{
+    session_id &= MAX_SESSION_ID;
+    uint64_t mask = (uint64_t)1 << (session_id % WORD_BITS);
+    uint64_t old = __sync_fetch_and_or(&live_ids[session_id / WORD_BITS], mask);
+    return (old & mask) == 0;
+}
+
+/*************************************************************************
+*  Function name: UniqueSessionId::release
+*  Description: mark a session id as free
+*  Parameter: uint32_t session_id
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void UniqueSessionId::release(uint32_t session_id)
+{
+    session_id &= MAX_SESSION_ID;
+    uint64_t mask = (uint64_t)1 << (session_id % WORD_BITS);
+    __sync_fetch_and_and(&live_ids[session_id / WORD_BITS], ~mask);
+}
+
+/*************************************************************************
+*  Function name: UniqueSessionId::is_live
+*  Description: determine whether a session id is live
+*  Parameter: uint32_t session_id
+*  Return: bool
+*  Remark:
+*  Modification record:
+*************************************************************************/
+bool UniqueSessionId::is_live(uint32_t session_id)
+{
+    session_id &= MAX_SESSION_ID;
+    uint64_t word = __sync_fetch_and_or(&live_ids[session_id / WORD_BITS], 0);
+    return (word >> (session_id % WORD_BITS)) & 1;
+}
+
+/*************************************************************************
+*  Function name: UniqueSessionId::allocate
+*  Description: pick a random session id that is not live and mark it live
+*  Parameter: uint32_t &session_id		//the allocated id
+*  Return: ERRNO
+*  Remark: random picks keep ids unpredictable, a scan for a free bit bounds the cost when the space is crowded
+*  Modification record:
+*************************************************************************/
+ERRNO UniqueSessionId::allocate(uint32_t &session_id)
+{
+    for(int i = 0; i < MAX_RANDOM_TRIES; i++)
+    {
+        uint32_t id = generate_random() & MAX_SESSION_ID;
+        if(reserve(id))
+        {
+            session_id = id;
+            return SUCCESS;
+        }
+    }
+
+    // start the scan at a random word and wrap around once
+    const uint32_t words = (MAX_SESSION_ID + 1) / WORD_BITS;
+    uint32_t start = generate_random() % words;
+    for(uint32_t n = 0; n < words; n++)
+    {
+        uint32_t w = (start + n) % words;
+        uint64_t word = live_ids[w];
+        while(word != ~(uint64_t)0)
+        {
+            uint32_t id = w * WORD_BITS + __builtin_ctzll(~word);
+            if(reserve(id))
+            {
+                session_id = id;
+                return SUCCESS;
+            }
+            word = live_ids[w];
+        }
+    }
+    return SESSION_ID_EXHAUSTED_ERR;
+}
@@ -0,0 +1,54 @@
+/*
+************************************************************************
+*                GDNP API v1.0
+* Draft : https://tools.ietf.org/html/draft-carpenter-anima-gdn-protocol-03
+* Abstract : 	
+* 		This document establishes requirements for a protocol that enables
+*		intelligent devices to dynamically discover peer devices, to
+*		synchronize state with them, and to negotiate parameter settings
+*		mutually with them.  The document then defines a general protocol for
+*		discovery, synchronization and negotiation, while the technical
+*		objectives for specific scenarios are to be described in separate
+*		documents.  An Appendix briefly discusses existing protocols with
+*		comparable features.
+*
+* File : [UniqueSessionId.h]
+* Description : Allocator of session ids. Every session id live on this node, started by the client side or
+*				received by the server side, is marked in a bitmap over the whole 24-bit space, so a new
+*				session never gets the id of a running one.
+* Remark : All functions are thread-safe and lock-free.
+* Modification record:
+* Copyright (c) 2015 Huawei Technologies Co., Ltd. All rights reserved.
+************************************************************************
+*/
+
+#ifndef demo_UniqueSessionId_h
+#define demo_UniqueSessionId_h
+
+#include <stdint.h>
+#include "msg.h"
+#include "Errno.h"
+
+class UniqueSessionId{
+public:
+    // pick a session id that is not live on this node and mark it live
+    static ERRNO allocate(uint32_t &session_id);
+    // mark a session id chosen by a peer as live, false if it is live already
+    static bool reserve(uint32_t session_id);
+    // the session has ended, its id can be handed out again
+    static void release(uint32_t session_id);
+    // determine whether a session id is live
+    static bool is_live(uint32_t session_id);
+
+private:
+    enum{
+        // bits in one word of the bitmap
+        WORD_BITS = 64,
+        // random picks before falling back to a scan of the bitmap
+        MAX_RANDOM_TRIES = 16
+    };
+    // one bit per session id, 2MB in total
+    static uint64_t live_ids[(MAX_SESSION_ID + 1) / WORD_BITS];
+};
+
+#endif
@@ -27,23 +27,28 @@
 
 #include "msg.h"
 #include <string.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <vector>
 
 // structure of processing queue item using in server session
 typedef struct content{
     enum MSG_TYPE type;
     char data[MAXSTRINGLENGTH];
+    // octets of data received
+    size_t data_len;
 
 /*************************************************************************
 *  Function name:operator ==
 *  Description:overload operator ==
 *  Parameter: 	const struct content &c	//to compare with the one who called this function
 *  Return:	true or false
-*  Remark:
+*  Remark: compares data_len octets, data may hold zeros
 *  Modification record:
 *  Lastly modified by Kangning Xu on 15-04-29
 *************************************************************************/
     bool operator == (const struct content &c) const{
-        if(type == c.type && strcmp(data,c.data) == 0){
+        if(type == c.type && data_len == c.data_len && memcmp(data,c.data,data_len) == 0){
             return 1;
         }
         return 0;
@@ -55,29 +60,48 @@ typedef struct content{
 *  Description:overload operator =
 *  Parameter: 	const struct content &c	//assign its value to the one who called this function
 *  Return:	struct content&
-*  Remark:
+*  Remark: copies data_len octets, data may hold zeros
 *  Modification record:
 *  Lastly modified by Kangning Xu on 15-04-29
 *************************************************************************/
     struct content& operator=(const struct content &c){
+        if(this == &c){
+            return *this;
+        }
         type = c.type;
-        strcpy(data,c.data);
+        // options are binary, copy by length and keep the terminator distribute() adds
+        data_len = c.data_len < MAXSTRINGLENGTH ? c.data_len : MAXSTRINGLENGTH;
+        memcpy(data,c.data,data_len);
+        if(data_len < MAXSTRINGLENGTH){
+            data[data_len] = '\0';
+        }
         return *this;
     }
 
 }content;
 
 
-class ServerMaster;
-class ServerSession;
+// an accepted tcp connection of ServerMaster
+typedef struct connection{
+    int fd;
+    // framing buffer, only the reactor thread uses it
+    pdu_reader reader;
+    // sessions started from this connection that have not ended yet
+    int sessions;
+    // the peer closed it or the stream went out of step, it is closed when the last session ends
+    bool closing;
+    // serialises the writers of the socket, sessions on any worker and the reactor, and guards out
+    pthread_mutex_t write_lock;
+    // PDUs the socket did not take yet, in order; the reactor writes them when it is writable
+    std::vector<char> out;
+}connection;
+
 
-// structure of parameter needed by threads running function
-typedef struct{
-    // pointer instance to a ServerMaster 
-    ServerMaster* sm;
-    // pointer instance to a ServerSession 
-    ServerSession* ss;
-}session_run_parms;
+// an IPv6 address of this node and the interface it is on
+typedef struct local_address{
+    unsigned int ifindex;
+    struct in6_addr addr;
+}local_address;
 
 
 #endif
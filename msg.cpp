@@ -25,7 +25,9 @@
 #include "msg.h"
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include <cstring>
+#include <errno.h>
 
 /*************************************************************************
 *  Function name: encode
@@ -41,46 +43,74 @@
 *  Lastly modified by Cheng Pang on 15-4-28
 *************************************************************************/
 ERRNO encode(msg* msg_p,enum MSG_TYPE type,uint32_t session_id,const void* data,size_t data_size){
+    ERRNO rtnval = encode_header(&msg_p->hdr, type, session_id, data_size);
+    if(rtnval != SUCCESS){
+        return rtnval;
+    }
+    // set data, only data_size bytes of it go on the wire
+    memcpy(msg_p->data, data, data_size);
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: encode_header
+*  Description: encode message header by rules
+*  Parameter:  hdr_p   header to send
+              	  	  type    message type
+              	  	  session_id
+              	  	  data_size    length of the data following the header
+*  Return:ERRNO
+*  Remark: used by the scatter/gather senders, which send data straight from the caller's buffer
+*  Modification record:
+*************************************************************************/
+ERRNO encode_header(msg_header* hdr_p,enum MSG_TYPE type,uint32_t session_id,size_t data_size){
     if(data_size > MAXSTRINGLENGTH){
         return OPTIONS_TOO_LONG_ERR;
     }
     if (session_id > MAX_SESSION_ID){
         return SESSION_ID_TOO_LONG_ERR;
     }
-    // initialize msg_p
-    memset(msg_p, 0, sizeof(msg));
     // set message type
-    msg_p->header = type<<SESSION_ID_SIZE;
+    hdr_p->header = type<<SESSION_ID_SIZE;
     // set session id
-    msg_p->header |= session_id;
+    hdr_p->header |= session_id;
 
     // set a random device id
-    msg_p->device_id = generate_random();
+    hdr_p->device_id = generate_random();
 
-    // set data
-    memcpy(msg_p->data, data, data_size);
+    hdr_p->data_len = data_size;
     return SUCCESS;
 }
 
 /*************************************************************************
-*  Function name: decode
-*  Description: decode message by rules
-*  Parameter: msg_p   received message
+*  Function name: decode_pdu
+*  Description: decode an encoded message lying anywhere in memory
+*  Parameter: pdu     first byte of the received message, need not be aligned
+              	  	  pdu_size    bytes received for pdu
               	  	  type    message type
               	  	  session_id
               	  	  data    buffer for decoded data
               	  	  data_size
 *  Return: ERRNO
-*  Remark:
+*  Remark: shared by decode() and pdu_reader_next()
 *  Modification record:
-*  Lastly modified by Cheng Pang on 15-4-28
 *************************************************************************/
-ERRNO decode(msg* msg_p,enum MSG_TYPE &type,uint32_t &session_id,char data[],size_t &data_size){
-    if(msg_p == NULL){
+static ERRNO decode_pdu(const char* pdu,size_t pdu_size,enum MSG_TYPE &type,uint32_t &session_id,char data[],size_t &data_size){
+    if(pdu == NULL){
         return NULL_POINT_ERR;
     }
+    if(pdu_size < MSG_HEADER_LEN){
+        return MSG_LEN_ERR;
+    }
+    msg_header hdr;
+    memcpy(&hdr, pdu, MSG_HEADER_LEN);
+    // the length field must cover exactly the bytes received
+    if(hdr.data_len > MAXSTRINGLENGTH
+       || MSG_HEADER_LEN + hdr.data_len != pdu_size){
+        return MSG_LEN_ERR;
+    }
     // msg type
-    int result = (msg_p->header) >> SESSION_ID_SIZE;
+    int result = (hdr.header) >> SESSION_ID_SIZE;
     switch (result) {
         case 1:
             type = DISCOVERY_MSG;
@@ -107,31 +137,156 @@ ERRNO decode(msg* msg_p,enum MSG_TYPE &type,uint32_t &session_id,char data[],siz
 
     // session id
     session_id = 0;
-    session_id = msg_p->header-(type<<SESSION_ID_SIZE);
+    session_id = hdr.header-(type<<SESSION_ID_SIZE);
 
     // device id
-//    uint32_t device_id = msg_p->device_id;
+//    uint32_t device_id = hdr.device_id;
 
     // data
-    memcpy(data, msg_p->data,MAXSTRINGLENGTH);
+    data_size = hdr.data_len;
+    memcpy(data, pdu + MSG_HEADER_LEN, data_size);
+    // keep string values readable by the upper layer
+    if(data_size < MAXSTRINGLENGTH){
+        data[data_size] = '\0';
+    }
 
-    data_size = sizeof(msg_p->data);
+    return SUCCESS;
+}
+
+/*************************************************************************
+*  Function name: decode
+*  Description: decode message by rules
+*  Parameter: msg_p   received message
+              	  	  msg_size    bytes received for msg_p
+              	  	  type    message type
+              	  	  session_id
+              	  	  data    buffer for decoded data
+              	  	  data_size
+*  Return: ERRNO
+*  Remark:
+*  Modification record:
+*  Lastly modified by Cheng Pang on 15-4-28
+*************************************************************************/
+ERRNO decode(msg* msg_p,size_t msg_size,enum MSG_TYPE &type,uint32_t &session_id,char data[],size_t &data_size){
+    return decode_pdu((const char*)msg_p, msg_size, type, session_id, data, data_size);
+}
 
+/*************************************************************************
+*  Function name: msg_size
+*  Description: number of bytes an encoded message occupies on the wire
+*  Parameter: msg_p   encoded message
+*  Return: size_t
+*  Remark: header plus data_len bytes of data
+*  Modification record:
+*************************************************************************/
+size_t msg_size(const msg* msg_p){
+    return MSG_HEADER_LEN + msg_p->hdr.data_len;
+}
+
+/*************************************************************************
+*  Function name: pdu_reader_init
+*  Description: empty a framing buffer, before it is used for a new connection
+*  Parameter: reader
+*  Return: void
+*  Remark:
+*  Modification record:
+*************************************************************************/
+void pdu_reader_init(pdu_reader* reader){
+    reader->start = 0;
+    reader->end = 0;
+}
+
+/*************************************************************************
+*  Function name: pdu_reader_fill
+*  Description: read whatever the connection has ready into the framing buffer, with one read()
+*  Parameter: reader
+              	  	  fd      stream socket the reader belongs to
+*  Return: ERRNO
+*  Remark: RECV_ERR when the peer closed the connection or the read failed,
+*          MSG_INCOMPLETE when a non-blocking fd had nothing ready
+*  Modification record:
+*************************************************************************/
+ERRNO pdu_reader_fill(pdu_reader* reader,int fd){
+    // move the unconsumed tail to the front, so a whole PDU always fits behind it
+    if(reader->start > 0){
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    ssize_t numBytes;
+    do{
+        numBytes = read(fd, reader->buffer + reader->end, PDU_READER_SIZE - reader->end);
+    }while(numBytes < 0 && errno == EINTR);
+    if(numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+        return MSG_INCOMPLETE;
+    }
+    if(numBytes <= 0){
+        return RECV_ERR;
+    }
+    reader->end += numBytes;
     return SUCCESS;
 }
 
+/*************************************************************************
+*  Function name: pdu_reader_next
+*  Description: take the next whole PDU out of the framing buffer and decode it
+*  Parameter: reader
+              	  	  type    message type
+              	  	  session_id
+              	  	  data    buffer for decoded data
+              	  	  data_size
+*  Return: ERRNO
+*  Remark: MSG_INCOMPLETE when the PDU is not all in the buffer yet, call pdu_reader_fill() then.
+*          MSG_LEN_ERR means the stream is out of step and the connection should be dropped.
+*  Modification record:
+*************************************************************************/
+ERRNO pdu_reader_next(pdu_reader* reader,enum MSG_TYPE &type,uint32_t &session_id,char data[],size_t &data_size){
+    size_t buffered = reader->end - reader->start;
+    if(buffered < MSG_HEADER_LEN){
+        return MSG_INCOMPLETE;
+    }
+    msg_header hdr;
+    memcpy(&hdr, reader->buffer + reader->start, MSG_HEADER_LEN);
+    if(hdr.data_len > MAXSTRINGLENGTH){
+        return MSG_LEN_ERR;
+    }
+    size_t pdu_size = MSG_HEADER_LEN + hdr.data_len;
+    if(buffered < pdu_size){
+        return MSG_INCOMPLETE;
+    }
+    const char* pdu = reader->buffer + reader->start;
+    reader->start += pdu_size;
+    if(reader->start == reader->end){
+        reader->start = 0;
+        reader->end = 0;
+    }
+    return decode_pdu(pdu, pdu_size, type, session_id, data, data_size);
+}
+
+// state of the random generator, one per thread so no locking is needed
+static thread_local uint64_t random_state = 0;
+
 /*************************************************************************
 *  Function name: generate_random
 *  Description: generate a random uint32_t
 *  Parameter: none
 *  Return: uint32_t
-*  Remark:
+*  Remark: xorshift64* generator, seeded once per thread from the clock and the thread's own address
 *  Modification record:
 *  Lastly modified by Cheng Pang on 15-4-28
 *************************************************************************/
 uint32_t generate_random(){
-    // using current time as seed
-    srand((unsigned)time( NULL ));
-    return (uint32_t)rand();
+    if(random_state == 0){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        random_state = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec
+                       ^ (uint64_t)(uintptr_t)&random_state ^ ((uint64_t)getpid() << 16);
+        if(random_state == 0){
+            random_state = 0x9E3779B97F4A7C15ULL;
+        }
+    }
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (uint32_t)((random_state * 0x2545F4914F6CDD1DULL) >> 32);
 }
-
@@ -50,17 +50,49 @@ enum{
 };
 
 
-typedef struct msg{
+// fixed part of a message, sent in front of the data on the wire
+typedef struct msg_header{
     uint32_t header;
     // device id
     uint32_t device_id;
+    // length of data in octets, only this many bytes of data are sent
+    uint32_t data_len;
+}msg_header;
+
+typedef struct msg{
+    msg_header hdr;
     // data
     char data[MAXSTRINGLENGTH+1];
 }msg;
 
+enum{
+    // length of msg_header on the wire
+    MSG_HEADER_LEN = sizeof(msg_header),
+    // framing buffer of a stream connection, room for several PDUs of the maximum size
+    PDU_READER_SIZE = 4 * (MSG_HEADER_LEN + MAXSTRINGLENGTH)
+};
+
+// bytes read from one stream connection and not yet taken out as PDUs,
+// TCP may split a PDU over several reads or deliver several PDUs in one
+typedef struct pdu_reader{
+    char buffer[PDU_READER_SIZE];
+    // first byte not taken out yet
+    size_t start;
+    // one past the last byte read
+    size_t end;
+}pdu_reader;
+
 
 ERRNO encode(msg* msg_p,enum MSG_TYPE type,uint32_t session_id,const void* data,size_t data_size);
-ERRNO decode(msg* msg_p,enum MSG_TYPE &type,uint32_t &session_id,char* data,size_t &data_size);
+// fill in the header only, data is sent from the caller's buffer
+ERRNO encode_header(msg_header* hdr_p,enum MSG_TYPE type,uint32_t session_id,size_t data_size);
+ERRNO decode(msg* msg_p,size_t msg_size,enum MSG_TYPE &type,uint32_t &session_id,char* data,size_t &data_size);
+// number of bytes an encoded message occupies on the wire
+size_t msg_size(const msg* msg_p);
+// framing of stream connections, fill once and take out every PDU received
+void pdu_reader_init(pdu_reader* reader);
+ERRNO pdu_reader_fill(pdu_reader* reader,int fd);
+ERRNO pdu_reader_next(pdu_reader* reader,enum MSG_TYPE &type,uint32_t &session_id,char* data,size_t &data_size);
 // get a random
 uint32_t generate_random();
 